@@ -21,10 +21,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #ifndef ARCHIVE_H
 #define ARCHIVE_H
 
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 #if defined(MO2_ARCHIVE_BUILD_STATIC)
 #define DLLEXPORT
@@ -37,6 +44,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 class FileData
 {
 public:
+  // XXH3 128-bit hash of the content of an entry, see getContentHash().
+  using ContentHash = std::array<uint8_t, 16>;
+
   /**
    * @return the path of this entry in the archive (usually relative, unless the archive
    *   contains absolute path).
@@ -79,9 +89,140 @@ public:
    */
   virtual bool isDirectory() const = 0;
 
+  /**
+   * @brief Mark this entry as a priority entry, i.e., one that should be available as
+   *   soon as possible during extraction.
+   *
+   * See Archive::extract() for how priority entries are handled.
+   *
+   * @param priority true to mark the entry as a priority entry, false otherwise.
+   */
+  virtual void setPriority(bool priority) = 0;
+
+  /**
+   * @return true if this entry is a priority entry, false otherwise.
+   */
+  virtual bool hasPriority() const = 0;
+
+  /**
+   * @return the hash of the content of this entry, computed while it was extracted
+   *   (see Archive::ExtractOptions::computeHashes), or an empty optional if it was not
+   *   computed or the extraction of this entry failed.
+   */
+  virtual std::optional<ContentHash> getContentHash() const = 0;
+
   virtual ~FileData() = default;
 };
 
+/**
+ * Read-only, file-like access to the content of a single entry of an archive,
+ * without extracting it to the disk.
+ *
+ * Decoded data is kept in a small cache so that repeated or nearby reads do not
+ * need to decode the entry again. For entries that can be accessed directly in the
+ * archive (e.g. stored or non-solid entries for most formats), reads at any offset
+ * are cheap. For other entries, reading backward past the cached data requires
+ * decoding the entry from its start again.
+ *
+ * A reader must not outlive the Archive it was created from, must not be used after
+ * the Archive has been closed or while it is extracting, and is not thread-safe.
+ */
+class ArchiveEntryReader
+{
+public:
+  /**
+   * @return the size of the entry in bytes (uncompressed).
+   */
+  virtual uint64_t getSize() const = 0;
+
+  /**
+   * @brief Read data from the entry.
+   *
+   * @param offset Offset in the entry to start reading from.
+   * @param buffer Buffer to read the data into, must be at least size bytes.
+   * @param size Number of bytes to read.
+   * @param bytesRead If not null, will contain the number of bytes actually read,
+   *   which is only less than size when reaching the end of the entry.
+   *
+   * @return true if the read succeeded, false otherwise.
+   */
+  virtual bool read(uint64_t offset, void* buffer, std::size_t size,
+                    std::size_t* bytesRead) = 0;
+
+  virtual ~ArchiveEntryReader() = default;
+};
+
+/**
+ * Source of an archive that is not a file, see Archive::openFromStream().
+ *
+ * Reads are positional, and may be issued concurrently from multiple threads (e.g.,
+ * by Archive::test()), so implementations must be thread-safe.
+ */
+class ArchiveStreamReader
+{
+public:
+  /**
+   * @return the size of the archive in bytes.
+   */
+  virtual uint64_t getSize() const = 0;
+
+  /**
+   * @brief Read data from the archive.
+   *
+   * @param offset Offset in the archive to start reading from.
+   * @param buffer Buffer to read the data into, must be at least size bytes.
+   * @param size Number of bytes to read.
+   * @param bytesRead If not null, will contain the number of bytes actually read,
+   *   which is only less than size when reaching the end of the archive.
+   *
+   * @return true if the read succeeded, false otherwise.
+   */
+  virtual bool read(uint64_t offset, void* buffer, std::size_t size,
+                    std::size_t* bytesRead) = 0;
+
+  /**
+   * @return true if the archive must be read in order, without seeking (e.g. the
+   *   data is received in order and the end of the archive is not available yet),
+   *   in which case the offsets passed to read() only increase.
+   *
+   * Only some formats (e.g. gz, xz or bz2) can be opened from sequential readers,
+   * and such archives can only be extracted or tested once.
+   */
+  virtual bool isSequential() const { return false; }
+
+  virtual ~ArchiveStreamReader() = default;
+};
+
+/**
+ * Reader over an archive file that is still being written (e.g. downloaded), so
+ * that the archive can be opened and extracted while it is received.
+ *
+ * The producer reports the ranges it has written to the file with markAvailable(),
+ * and reads block until the range they need is available. When a read needs data far
+ * ahead of what has been received (e.g. the headers at the end of 7z or zip
+ * archives), the range request callback is called so that the producer can fetch
+ * that range first.
+ *
+ * See CreateGrowingFileReader().
+ */
+class GrowingFileReader : public ArchiveStreamReader
+{
+public:
+  using RangeRequestCallback = std::function<void(uint64_t offset, uint64_t size)>;
+
+  /**
+   * @brief Report that the given range has been written to the file. Thread-safe.
+   */
+  virtual void markAvailable(uint64_t offset, uint64_t size) = 0;
+
+  /**
+   * @brief Report that no more data will be written, whether the file is complete or
+   * not. Reads of ranges that are not available then fail instead of blocking.
+   * Thread-safe.
+   */
+  virtual void finish() = 0;
+};
+
 class Archive
 {
 public:  // Declarations
@@ -118,6 +259,67 @@ public:  // Declarations
     EXTRACTION
   };
 
+  /**
+   * Statistics about the progress of an extraction, see setProgressStatsCallback().
+   */
+  struct ProgressStats
+  {
+    // Number of bytes processed so far, and total number of bytes to process.
+    uint64_t completed;
+    uint64_t total;
+
+    // Number of entries processed so far.
+    uint64_t files;
+
+    // Smoothed processing rates.
+    double bytesPerSecond;
+    double filesPerSecond;
+
+    // Estimated remaining time, negative if it cannot be estimated yet.
+    std::chrono::milliseconds eta;
+  };
+
+  /**
+   * Snapshot of the progress of the current (or last) extraction, see getProgress().
+   */
+  struct ProgressSnapshot
+  {
+    static constexpr std::size_t NO_INDEX = static_cast<std::size_t>(-1);
+
+    // Number of bytes read from the archive and written to the disk so far.
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+
+    // Index (in getFileList()) of the entry being extracted, or NO_INDEX.
+    std::size_t currentIndex;
+
+    // Number of entries extracted and number of errors so far.
+    uint64_t filesDone;
+    uint64_t errors;
+
+    // Number of events that were dropped because they were not polled in time.
+    uint64_t droppedEvents;
+  };
+
+  enum class ProgressEventType
+  {
+    ENTRY_START,
+    ENTRY_END,
+    ERROR
+  };
+
+  /**
+   * Event of an extraction, see pollProgressEvent().
+   */
+  struct ProgressEvent
+  {
+    ProgressEventType type;
+
+    // Index (in getFileList()) of the entry concerned by the event, or
+    // ProgressSnapshot::NO_INDEX.
+    std::size_t index;
+  };
+
   enum class FileChangeType
   {
     EXTRACTION_START,
@@ -131,10 +333,17 @@ public:  // Declarations
    */
   using LogCallback        = std::function<void(LogLevel, std::wstring const& log)>;
   using ProgressCallback   = std::function<void(ProgressType, uint64_t, uint64_t)>;
+  using ProgressStatsCallback =
+      std::function<void(ProgressType, ProgressStats const&)>;
   using PasswordCallback   = std::function<std::wstring()>;
   using FileChangeCallback = std::function<void(FileChangeType, std::wstring const&)>;
   using ErrorCallback      = std::function<void(std::wstring const&)>;
 
+  // Resolve the volume with the given name (e.g. "archive.7z.002") of an archive
+  // opened from memory or from a stream, returning null if there is no such volume.
+  using VolumeResolver =
+      std::function<std::shared_ptr<ArchiveStreamReader>(std::wstring const& name)>;
+
   /**
    *
    */
@@ -149,7 +358,223 @@ public:  // Declarations
     ERROR_INVALID_ARCHIVE_FORMAT,
     ERROR_LIBRARY_ERROR,
     ERROR_ARCHIVE_INVALID,
-    ERROR_OUT_OF_MEMORY
+    ERROR_OUT_OF_MEMORY,
+    ERROR_INVALID_ENTRY,
+    ERROR_NOT_ENOUGH_SPACE,
+    ERROR_OPEN_CANCELLED
+  };
+
+  /**
+   * Options controlling how extract() writes the extracted files.
+   */
+  struct ExtractOptions
+  {
+    // Reserve disk space for each output file before writing it, which reduces
+    // fragmentation of large files.
+    bool preallocate = false;
+
+    // Number of entries ahead of the one being decoded for which output files are
+    // created (and preallocated) on a helper thread, e.g. 16. Entries whose files
+    // already exist are left to the extraction. 0 (the default) disables the helper
+    // thread.
+    std::size_t preallocateLookahead = 0;
+
+    // Check that the output volume has enough free space before starting the
+    // extraction. If not, extract() fails with ERROR_NOT_ENOUGH_SPACE.
+    bool checkFreeSpace = false;
+
+    // Entries smaller than this (in bytes) are kept in memory and written to the
+    // disk in one go by a pool of writer threads, while the decoder moves on to the
+    // next entry, e.g. 128 KiB. 0 (the default) disables this.
+    std::size_t smallFileThreshold = 0;
+
+    // Number of writer threads used when smallFileThreshold is set. 0 disables the
+    // pool.
+    std::size_t writerThreads = 4;
+
+    // Entries larger than this (in bytes) are written with unbuffered I/O, bypassing
+    // the system file cache, so that extracting very large files does not evict
+    // everything else from it. 0 (the default) disables unbuffered I/O.
+    uint64_t directIOThreshold = 0;
+
+    // Number of threads used to close output files (and set their time and
+    // attributes) once they are written, so that the decoder does not wait for it,
+    // e.g. 2. 0 (the default) closes the files on the extraction thread.
+    std::size_t closeThreads = 0;
+
+    // Maximum number of files waiting to be closed. The extraction waits when this is
+    // reached, which bounds the number of open handles.
+    std::size_t maxPendingCloses = 64;
+
+    // Maximum amount of memory (in bytes) used by the extraction, including the
+    // dictionaries of the decoders and the buffers used to write the files. If the
+    // decoders alone would use all of it, extract() fails with ERROR_OUT_OF_MEMORY
+    // without starting; otherwise, files are not buffered in memory when that would
+    // exceed it. 0 (the default) means no limit.
+    uint64_t memoryBudget = 0;
+
+    // Run the writes and closes of this extraction on the process-wide scheduler
+    // shared with other Archive instances (see ConfigureExtractionScheduler())
+    // instead of on threads of its own. writerThreads and closeThreads then only
+    // enable (if not 0) or disable the corresponding features.
+    bool useSharedScheduler = false;
+
+    // Minimum interval between two progress notifications of the same type. Updates
+    // in-between are coalesced. 0 notifies every update.
+    std::chrono::milliseconds progressInterval{100};
+
+    // Progress is also notified when at least this many bytes have been processed
+    // since the last notification, regardless of progressInterval. 0 disables this.
+    uint64_t progressGranularity = 0;
+
+    // Number of threads used by test() for non-solid archives, each with its own
+    // instance of the format handler. 0 uses the number of hardware threads.
+    std::size_t testThreads = 0;
+
+    // Hash the content of the entries as it is written, so that it does not have to
+    // be read back afterwards, see FileData::getContentHash().
+    bool computeHashes = false;
+
+    // Compute the CRC of the entries as they are written and compare it to the one
+    // stored in the archive (see FileData::getCRC()), for formats whose handler does
+    // not check it. Mismatches are reported through the error callback.
+    bool verifyCRC = false;
+  };
+
+  /**
+   * Options passed to the format handlers when opening archives, see
+   * setHandlerOptions().
+   */
+  struct HandlerOptions
+  {
+    // Number of threads used by the decoders that support multi-threading (e.g.,
+    // LZMA2, xz, zstd, bzip2). 0 uses the default of 7z.
+    uint32_t threads = 0;
+
+    // Maximum amount of memory (in bytes) the decoders are allowed to use. 0 uses
+    // the default of 7z.
+    uint64_t memoryUsage = 0;
+
+    // Additional properties, as name/value pairs, using the same syntax as the -m
+    // switch of 7z (e.g., {L"mt", L"off"}).
+    std::vector<std::pair<std::wstring, std::wstring>> properties;
+  };
+
+  /**
+   * How archives are expected to be read, see OpenOptions::accessPattern.
+   */
+  enum class AccessPattern
+  {
+    // Detect sequential reads and read ahead when they are.
+    AUTO,
+
+    // Mostly sequential reads (e.g., solid archives), always read ahead.
+    SEQUENTIAL,
+
+    // Mostly small reads at random offsets, never read ahead.
+    RANDOM
+  };
+
+  /**
+   * Options used to read archives, see setOpenOptions().
+   */
+  struct OpenOptions
+  {
+    // Archives (and volumes) on local drives larger than this (in bytes) are read
+    // through a memory mapping instead of read calls, which makes the many small
+    // reads and seeks done when parsing headers (e.g., the central directory of zip
+    // archives) nearly free. 0 disables memory mapping.
+    uint64_t memoryMapThreshold = 16 << 20;
+
+    // Expected access pattern, used to read ahead of memory-mapped archives.
+    AccessPattern accessPattern = AccessPattern::AUTO;
+
+    // Archives that are not memory-mapped are read ahead on a background thread when
+    // they are read sequentially, which hides the latency of slow drives (e.g., hard
+    // drives or network shares) behind decoding. This is the maximum size (in bytes)
+    // of a read: reads start small and grow while the archive is read sequentially.
+    // 0 disables reading ahead.
+    std::size_t readAheadSize = 4 << 20;
+
+    // Maximum number of reads ahead of the current position.
+    std::size_t readAheadCount = 4;
+
+    // Size (in bytes) of the cache shared by the handlers that read the same archive
+    // concurrently through a single handle, e.g., in test(). 0 disables the cache.
+    std::size_t sharedCacheSize = 8 << 20;
+  };
+
+  /**
+   * Estimated or measured memory usage of an extraction, see
+   * estimateExtractionMemory() and getExtractionMemoryReport().
+   */
+  struct MemoryUsage
+  {
+    // Memory used by the decoders (estimated from the compression methods).
+    uint64_t decoderBytes;
+
+    // Memory used by the buffers of the extraction (write-behind, unbuffered I/O).
+    uint64_t bufferBytes;
+
+    // Increase of the private memory of the process during the extraction. Only set
+    // in reports, and includes the memory used by other threads of the process.
+    uint64_t processBytes;
+  };
+
+  /**
+   * I/O performed by an open or an extraction, see getOpenIOStats() and
+   * getExtractIOStats().
+   */
+  struct IOStats
+  {
+    // Reads from the archive and its volumes, and bytes read again after seeking
+    // backward.
+    uint64_t bytesRead;
+    uint64_t readCalls;
+    uint64_t seeks;
+    uint64_t bytesReread;
+
+    // Writes to the extracted files, and files opened and closed (or handed to
+    // another thread to be closed).
+    uint64_t bytesWritten;
+    uint64_t writeCalls;
+    uint64_t fileOpens;
+    uint64_t fileCloses;
+    uint64_t setSizeCalls;
+  };
+
+  /**
+   * Latency statistics of an instrumented operation, see
+   * GetInstrumentationReport().
+   */
+  struct TimerStats
+  {
+    std::wstring name;
+    uint64_t calls;
+    std::chrono::nanoseconds total;
+
+    // Percentiles are approximate, within 1/8th of their actual value.
+    std::chrono::nanoseconds p50;
+    std::chrono::nanoseconds p99;
+    std::chrono::nanoseconds max;
+  };
+
+  /**
+   * Options of the process-wide extraction scheduler, see
+   * ConfigureExtractionScheduler().
+   */
+  struct SchedulerOptions
+  {
+    // Number of writer threads shared by all the extractions.
+    std::size_t writerThreads = 8;
+
+    // Maximum number of bytes held in memory, waiting to be written, over all the
+    // extractions.
+    uint64_t maxInFlightBytes = 512 * 1024 * 1024;
+
+    // Maximum number of extractions writing to the same volume at once. Other
+    // extractions wait, in order of arrival, in extract().
+    std::size_t maxExtractionsPerDevice = 2;
   };
 
 public:  // Special member functions:
@@ -182,6 +607,49 @@ public:
    */
   virtual void setLogCallback(LogCallback logCallback) = 0;
 
+  /**
+   * @brief Set the callback notified with detailed progress statistics during
+   * extraction, in addition to the progress callback given to extract().
+   *
+   * Both callbacks are notified at the rate configured by
+   * ExtractOptions::progressInterval and ExtractOptions::progressGranularity.
+   *
+   * @param progressStatsCallback The new callback, or a default-constructed one to
+   *     remove it.
+   */
+  virtual void setProgressStatsCallback(ProgressStatsCallback progressStatsCallback) = 0;
+
+  /**
+   * @brief Set the options passed to the format handler by open().
+   *
+   * Options that a handler does not support are ignored. This only applies to
+   * archives opened after the call.
+   *
+   * @param options The new options.
+   */
+  virtual void setHandlerOptions(HandlerOptions const& options) = 0;
+
+  /**
+   * @brief Set the options used to read archives.
+   *
+   * This only applies to archives opened after the call.
+   *
+   * @param options The new options.
+   */
+  virtual void setOpenOptions(OpenOptions const& options) = 0;
+
+  /**
+   * @brief Set the options used by extract().
+   *
+   * @param options The new options.
+   */
+  virtual void setExtractOptions(ExtractOptions const& options) = 0;
+
+  /**
+   * @return the options used by extract().
+   */
+  virtual ExtractOptions const& getExtractOptions() const = 0;
+
   /**
    * @brief Open the given archive.
    *
@@ -195,6 +663,43 @@ public:
   virtual bool open(std::wstring const& archivePath,
                     PasswordCallback passwordCallback) = 0;
 
+  /**
+   * @brief Open an archive stored in memory.
+   *
+   * The data is read in place, so it must remain valid until the archive is closed.
+   *
+   * @param data Content of the archive.
+   * @param name Name of the archive, used to find the format when the content does
+   *   not start with a known signature, and to name the other volumes. May be empty.
+   * @param passwordCallback Callback to use to ask user for password, see open().
+   * @param volumeResolver Callback used to retrieve the other volumes of a
+   *   multi-volume archive. If empty, only the given volume is opened.
+   *
+   * @return true if the archive was open properly, false otherwise.
+   */
+  virtual bool openFromMemory(std::span<const std::byte> data,
+                              std::wstring const& name,
+                              PasswordCallback passwordCallback,
+                              VolumeResolver volumeResolver = {}) = 0;
+
+  /**
+   * @brief Open an archive read through the given reader.
+   *
+   * The reader (and the volume resolver) are kept until the archive is closed.
+   *
+   * @param reader Reader for the content of the archive.
+   * @param name Name of the archive, see openFromMemory().
+   * @param passwordCallback Callback to use to ask user for password, see open().
+   * @param volumeResolver Callback used to retrieve the other volumes of a
+   *   multi-volume archive. If empty, only the given volume is opened.
+   *
+   * @return true if the archive was open properly, false otherwise.
+   */
+  virtual bool openFromStream(std::shared_ptr<ArchiveStreamReader> reader,
+                              std::wstring const& name,
+                              PasswordCallback passwordCallback,
+                              VolumeResolver volumeResolver = {}) = 0;
+
   /**
    * @brief Close the currently opened archive.
    */
@@ -205,6 +710,49 @@ public:
    */
   virtual const std::vector<FileData*>& getFileList() const = 0;
 
+  /**
+   * @brief Open a single entry of the currently opened archive for reading.
+   *
+   * @param index Index of the entry in the list returned by getFileList().
+   *
+   * @return a reader for the entry, or a null pointer if the entry could not be
+   *   opened (e.g. no archive is open, the entry is a directory, or the archive was
+   *   opened from a sequential reader).
+   */
+  virtual std::unique_ptr<ArchiveEntryReader> openEntry(std::size_t index) = 0;
+
+  /**
+   * @return the indices of the solid blocks containing the priority entries that are
+   *     selected for extraction (i.e., with output paths). This is empty if the
+   *     archive is not solid, or does not report its blocks.
+   */
+  virtual std::vector<uint32_t> getPriorityBlocks() const = 0;
+
+  /**
+   * @brief Estimate the memory extract() would need to extract the selected entries
+   * (i.e., the ones with output paths) with the current options.
+   *
+   * @return the estimated memory usage, processBytes is always 0.
+   */
+  virtual MemoryUsage estimateExtractionMemory() const = 0;
+
+  /**
+   * @return the peak memory usage of the last extraction. decoderBytes is the
+   *     estimate since the memory used by the decoders cannot be measured.
+   */
+  virtual MemoryUsage getExtractionMemoryReport() const = 0;
+
+  /**
+   * @return the I/O performed by the last open (from a file, from memory or from a
+   *     stream).
+   */
+  virtual IOStats getOpenIOStats() const = 0;
+
+  /**
+   * @return the I/O performed by the last call to extract() or test().
+   */
+  virtual IOStats getExtractIOStats() const = 0;
+
   /**
    * @brief Extract the content of the archive.
    *
@@ -212,6 +760,12 @@ public:
    * file. All the callbacks are optional (you can specify default-constructed
    * std::function). Overloads with one or two callbacks are also provided.
    *
+   * Priority entries (see FileData::setPriority()) are extracted before the others
+   * when the archive allows it: for non-solid archives, priority entries come first,
+   * and for solid archives, the solid blocks containing priority entries come first.
+   * Solid archives that do not report their blocks are extracted in archive order,
+   * see getPriorityBlocks().
+   *
    * @param outputDirectory Path to the directory where the archive should be extracted.
    * If not empty, conflicting files will be replaced by the extracted ones.
    * @param progressCallback Function called to notify extraction progress.
@@ -227,10 +781,55 @@ public:
                        ErrorCallback errorCallback) = 0;
 
   /**
-   * @brief Cancel the current extraction process.
+   * @brief Cancel the current opening or extraction process.
+   *
+   * This can be called from any thread at any time. The operation stops shortly
+   * after (typically after the next block of data is written), and the output file
+   * of the entry being extracted, if any, is removed. Calling this when no operation
+   * is running has no effect.
    */
   virtual void cancel() = 0;
 
+  /**
+   * @brief Test the integrity of the entries of the archive, without writing them.
+   *
+   * Every entry is decoded and checked (e.g., against its CRC), and each entry that
+   * fails is reported through the error callback, with the reason. Non-solid
+   * archives are tested on multiple threads (see ExtractOptions::testThreads),
+   * solid archives on the calling thread. The test can be cancelled with cancel().
+   *
+   * @param errorCallback Function called for each entry that fails.
+   *
+   * @return true if all the entries are valid, false otherwise.
+   */
+  virtual bool test(ErrorCallback errorCallback) = 0;
+
+  /**
+   * @brief Retrieve the progress of the current extraction (or of the last one if
+   * no extraction is running).
+   *
+   * This can be called from any thread and never blocks the extraction, so it is an
+   * alternative to the progress callbacks, which are called from the extraction
+   * thread.
+   *
+   * @return a consistent snapshot of the progress counters.
+   */
+  virtual ProgressSnapshot getProgress() const = 0;
+
+  /**
+   * @brief Retrieve the next extraction event, if any.
+   *
+   * Events are kept in a bounded queue: if they are not polled often enough, new
+   * events are dropped (see ProgressSnapshot::droppedEvents) rather than slowing down
+   * the extraction. This can be called from any thread, but not from multiple threads
+   * at the same time.
+   *
+   * @param event Receives the event.
+   *
+   * @return true if an event was retrieved, false if the queue was empty.
+   */
+  virtual bool pollProgressEvent(ProgressEvent& event) = 0;
+
   // A bunch of useful overloads (with one or two callbacks):
   bool extract(std::wstring const& outputDirectory, ErrorCallback errorCallback)
   {
@@ -269,4 +868,79 @@ public:
  */
 DLLEXPORT std::unique_ptr<Archive> CreateArchive();
 
+/**
+ * @brief Create a reader over a file that is still being written, see
+ * GrowingFileReader.
+ *
+ * @param path Path to the file, which must exist and be shared for reading.
+ * @param size Final size of the file.
+ * @param rangeRequestCallback Callback called when a range far ahead of the received
+ *   data is needed. May be empty.
+ * @param sequential If true, the archive is read in order (see
+ *   ArchiveStreamReader::isSequential()), which does not need the end of the
+ *   archive but is only supported by some formats.
+ *
+ * @return the reader, or a null pointer if the file could not be opened.
+ */
+DLLEXPORT std::shared_ptr<GrowingFileReader>
+CreateGrowingFileReader(std::wstring const& path, uint64_t size,
+                        GrowingFileReader::RangeRequestCallback rangeRequestCallback,
+                        bool sequential = false);
+
+/**
+ * @brief Configure the process-wide scheduler used by extractions that set
+ * ExtractOptions::useSharedScheduler.
+ *
+ * The limits apply immediately, but the number of writer threads is only taken into
+ * account if this is called before the first extraction using the scheduler.
+ *
+ * @param options The new options.
+ */
+DLLEXPORT void ConfigureExtractionScheduler(Archive::SchedulerOptions const& options);
+
+/**
+ * @brief Enable or disable the instrumentation of the library.
+ *
+ * When enabled, the duration of the main operations of all the archives (opening,
+ * listing, and the callbacks of extractions) is recorded until the instrumentation
+ * is disabled. Instrumentation is disabled by default, and costs almost nothing
+ * then.
+ *
+ * @param enabled true to enable the instrumentation, false to disable it.
+ */
+DLLEXPORT void EnableInstrumentation(bool enabled);
+
+/**
+ * @return the statistics of the instrumented operations recorded since the last
+ *     reset, for all the archives and threads of the process.
+ */
+DLLEXPORT std::vector<Archive::TimerStats> GetInstrumentationReport();
+
+/**
+ * @brief Clear the statistics of the instrumented operations.
+ */
+DLLEXPORT void ResetInstrumentation();
+
+/**
+ * @brief Start recording a trace of the open and extraction operations of all the
+ * archives, discarding the previous trace.
+ *
+ * The trace contains a span for every probed format, every callback of extractions
+ * and every write and close of output files, with the thread and the entry they
+ * belong to. Tracing is disabled by default, and costs almost nothing then.
+ */
+DLLEXPORT void StartTracing();
+
+/**
+ * @brief Stop recording the trace. It can still be exported afterwards.
+ */
+DLLEXPORT void StopTracing();
+
+/**
+ * @return the trace recorded since the last call to StartTracing(), as Chrome
+ *     trace-event JSON (UTF-8) that can be loaded in chrome://tracing or Perfetto.
+ *     Only the most recent spans are kept if there are too many.
+ */
+DLLEXPORT std::string ExportTrace();
+
 #endif  // ARCHIVE_H
@@ -0,0 +1,95 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_ALIGNEDBUFFER_H
+#define ARCHIVE_ALIGNEDBUFFER_H
+
+#include <malloc.h>
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/**
+ * Pool of fixed-size, aligned buffers, used for unbuffered I/O which requires both
+ * the memory and the size of every write to be aligned on the sector size.
+ *
+ * Buffers are allocated on demand and kept for reuse once released, so the number
+ * of allocations is bounded by the number of buffers in use at the same time.
+ */
+class AlignedBufferPool
+{
+public:
+  struct Deleter
+  {
+    void operator()(unsigned char* buffer) const { _aligned_free(buffer); }
+  };
+  using Buffer = std::unique_ptr<unsigned char[], Deleter>;
+
+  AlignedBufferPool(std::size_t bufferSize, std::size_t alignment)
+      : m_BufferSize(bufferSize), m_Alignment(alignment)
+  {}
+
+  std::size_t bufferSize() const { return m_BufferSize; }
+  std::size_t alignment() const { return m_Alignment; }
+
+  /**
+   * @return a buffer of bufferSize() bytes aligned on alignment().
+   */
+  Buffer acquire()
+  {
+    {
+      std::scoped_lock lock(m_Mutex);
+      if (!m_Buffers.empty()) {
+        Buffer buffer = std::move(m_Buffers.back());
+        m_Buffers.pop_back();
+        return buffer;
+      }
+    }
+
+    auto* buffer =
+        static_cast<unsigned char*>(_aligned_malloc(m_BufferSize, m_Alignment));
+    if (buffer == nullptr) {
+      throw std::bad_alloc();
+    }
+    return Buffer(buffer);
+  }
+
+  /**
+   * @brief Give back a buffer obtained from acquire() to the pool.
+   */
+  void release(Buffer buffer)
+  {
+    if (buffer) {
+      std::scoped_lock lock(m_Mutex);
+      m_Buffers.push_back(std::move(buffer));
+    }
+  }
+
+private:
+  std::size_t m_BufferSize;
+  std::size_t m_Alignment;
+
+  std::mutex m_Mutex;
+  std::vector<Buffer> m_Buffers;
+};
+
+#endif
@@ -21,29 +21,51 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "archive.h"
 #include <Unknwn.h>
 
+#include "cancellation.h"
+#include "countinginputstream.h"
+#include "entryreader.h"
 #include "extractcallback.h"
 #include "inputstream.h"
+#include "instrument.h"
 #include "library.h"
+#include "memorybudget.h"
 #include "opencallback.h"
+#include "positionalinputstream.h"
+#include "progressstate.h"
 #include "propertyvariant.h"
+#include "readerinputstream.h"
+#include "scheduler.h"
+#include "testcallback.h"
+#include "tracer.h"
+#include "volumemanager.h"
 
 #include <algorithm>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <stddef.h>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 namespace PropID = NArchive::NHandlerPropID;
 
+// Timers of the open path, see EnableInstrumentation().
+static ArchiveTimers::Timer OpenTimer(L"Open");
+static ArchiveTimers::Timer OpenHandlerTimer(L"Open.Handler");
+static ArchiveTimers::Timer ResetFileListTimer(L"ResetFileList");
+
 class FileDataImpl : public FileData
 {
   friend class Archive;
 
 public:
   FileDataImpl(std::wstring const& fileName, UInt64 size, UInt64 crc, bool isDirectory)
-      : m_FileName(fileName), m_Size(size), m_CRC(crc), m_IsDirectory(isDirectory)
+      : m_FileName(fileName), m_Size(size), m_CRC(crc), m_IsDirectory(isDirectory),
+        m_Priority(false)
   {}
 
   virtual std::wstring getArchiveFilePath() const override { return m_FileName; }
@@ -64,12 +86,23 @@ public:
   virtual bool isDirectory() const override { return m_IsDirectory; }
   virtual uint64_t getCRC() const override { return m_CRC; }
 
+  virtual void setPriority(bool priority) override { m_Priority = priority; }
+  virtual bool hasPriority() const override { return m_Priority; }
+
+  virtual std::optional<ContentHash> getContentHash() const override
+  {
+    return m_ContentHash;
+  }
+  void setContentHash(std::optional<ContentHash> hash) { m_ContentHash = hash; }
+
 private:
   std::wstring m_FileName;
   UInt64 m_Size;
   UInt64 m_CRC;
   std::vector<std::wstring> m_OutputFilePaths;
   bool m_IsDirectory;
+  bool m_Priority;
+  std::optional<ContentHash> m_ContentHash;
 };
 
 /// represents the connection to one archive and provides common functionality
@@ -93,10 +126,44 @@ public:
     m_LogCallback = logCallback ? logCallback : DefaultLogCallback;
   }
 
+  virtual void
+  setProgressStatsCallback(ProgressStatsCallback progressStatsCallback) override
+  {
+    m_ProgressStatsCallback = progressStatsCallback;
+  }
+
+  virtual void setHandlerOptions(HandlerOptions const& options) override
+  {
+    m_HandlerOptions = options;
+  }
+
+  virtual void setOpenOptions(OpenOptions const& options) override
+  {
+    m_OpenOptions = options;
+  }
+
+  virtual void setExtractOptions(ExtractOptions const& options) override
+  {
+    m_ExtractOptions = options;
+  }
+  virtual ExtractOptions const& getExtractOptions() const override
+  {
+    return m_ExtractOptions;
+  }
+
   virtual bool open(std::wstring const& archiveName,
                     PasswordCallback passwordCallback) override;
+  virtual bool openFromMemory(std::span<const std::byte> data,
+                              std::wstring const& name,
+                              PasswordCallback passwordCallback,
+                              VolumeResolver volumeResolver) override;
+  virtual bool openFromStream(std::shared_ptr<ArchiveStreamReader> reader,
+                              std::wstring const& name,
+                              PasswordCallback passwordCallback,
+                              VolumeResolver volumeResolver) override;
   virtual void close() override;
   const std::vector<FileData*>& getFileList() const override { return m_FileList; }
+  virtual std::unique_ptr<ArchiveEntryReader> openEntry(std::size_t index) override;
   virtual bool extract(std::wstring const& outputDirectory,
                        ProgressCallback progressCallback,
                        FileChangeCallback fileChangeCallback,
@@ -104,12 +171,71 @@ public:
 
   virtual void cancel() override;
 
+  virtual bool test(ErrorCallback errorCallback) override;
+
+  virtual std::vector<uint32_t> getPriorityBlocks() const override;
+  virtual MemoryUsage estimateExtractionMemory() const override;
+  virtual IOStats getOpenIOStats() const override { return m_OpenIOStats; }
+  virtual IOStats getExtractIOStats() const override { return m_ExtractIOStats; }
+  virtual MemoryUsage getExtractionMemoryReport() const override
+  {
+    return m_MemoryReport;
+  }
+
+  virtual ProgressSnapshot getProgress() const override
+  {
+    return m_ProgressState.snapshot();
+  }
+  virtual bool pollProgressEvent(ProgressEvent& event) override
+  {
+    return m_ProgressState.pop(event);
+  }
+
 private:
   void clearFileList();
   void resetFileList();
 
   HRESULT loadFormats();
 
+  // Find the format of the given stream and open it, see open(). The name is only
+  // used for its extension and for logging.
+  bool openArchive(IInStream* file, CArchiveOpenCallback* openCallbackPtr,
+                   std::wstring const& name);
+
+  // Open m_Source, which can only be read in order, see openFromStream().
+  bool openSequential(std::wstring const& name);
+
+  // Callback to open the archive (or another instance of its handler).
+  CComPtr<CArchiveOpenCallback> createOpenCallback();
+
+  // Create a handler for the given format, and pass it the handler options.
+  bool createHandler(GUID const& classID, CComPtr<IInArchive>& handler) const;
+
+  // Open another instance of the handler of the open archive, which can be used
+  // concurrently with m_ArchivePtr. If a shared file is given, the instance reads
+  // the archive through it instead of opening it again.
+  CComPtr<IInArchive> openHandlerInstance(std::shared_ptr<SharedFile> const& file);
+
+  // Test the given entries with the given handler, see test().
+  HRESULT testEntries(IInArchive* handler, std::vector<UInt32> const& indices,
+                      CArchiveTestCallback::ErrorCallback const& errorCallback,
+                      Archive::PasswordCallback const& passwordCallback);
+
+  // Whether the open archive is solid.
+  bool isSolid() const;
+
+  // Solid block containing the given entry, if the archive reports it.
+  std::optional<UInt32> blockOf(UInt32 index) const;
+
+  // Split the given entries into groups to extract one after the other, so that
+  // priority entries come first.
+  std::vector<std::vector<UInt32>> groupByPriority(std::vector<UInt32> const& indices);
+
+  // Check that the volume containing the output directory can hold the selected
+  // entries.
+  bool checkFreeSpace(std::filesystem::path const& outputDirectory,
+                      ErrorCallback const& errorCallback) const;
+
 private:
   typedef UINT32(WINAPI* CreateObjectFunc)(const GUID* clsID, const GUID* interfaceID,
                                            void** outObject);
@@ -133,10 +259,32 @@ private:
   ALibrary m_Library;
   std::wstring m_ArchiveName;  // TBH I don't think this is required
   CComPtr<IInArchive> m_ArchivePtr;
-  CArchiveExtractCallback* m_ExtractCallback;
+  CancellationToken m_CancelToken;
+
+  // Path and format of the open archive, to open other instances of its handler.
+  // Archives opened from memory or from a stream have a source instead, and their
+  // path is only the name they were opened with.
+  std::filesystem::path m_ArchivePath;
+  std::shared_ptr<ArchiveStreamReader> m_Source;
+  VolumeResolver m_VolumeResolver;
+  GUID m_HandlerClassID;
 
   LogCallback m_LogCallback;
   PasswordCallback m_PasswordCallback;
+  ProgressStatsCallback m_ProgressStatsCallback;
+  ExtractOptions m_ExtractOptions;
+  HandlerOptions m_HandlerOptions;
+  OpenOptions m_OpenOptions;
+
+  // Volumes of the open archive, found with a single scan of its directory.
+  std::shared_ptr<VolumeManager> m_Volumes;
+  MemoryUsage m_MemoryReport;
+  ProgressState m_ProgressState;
+
+  // I/O of the streams of the open archive, and of the last open and extraction.
+  IOCounters m_IOCounters;
+  IOStats m_OpenIOStats;
+  IOStats m_ExtractIOStats;
 
   std::vector<FileData*> m_FileList;
 
@@ -270,7 +418,8 @@ HRESULT ArchiveImpl::loadFormats()
 
 ArchiveImpl::ArchiveImpl()
     : m_Valid(false), m_LastError(Error::ERROR_NONE), m_Library("dlls/7zip.dll"),
-      m_PasswordCallback{}
+      m_HandlerClassID{}, m_PasswordCallback{}, m_MemoryReport{}, m_OpenIOStats{},
+      m_ExtractIOStats{}
 {
   // Reset the log callback:
   setLogCallback({});
@@ -314,9 +463,13 @@ ArchiveImpl::~ArchiveImpl()
 bool ArchiveImpl::open(std::wstring const& archiveName,
                        PasswordCallback passwordCallback)
 {
+  auto guard = OpenTimer.instrument();
+  ArchiveTrace::Span span("open", "Open", ArchiveTrace::NO_ENTRY,
+                          std::filesystem::path(archiveName).filename().native());
   m_ArchiveName = archiveName;  // Just for debugging, not actually used...
-
-  Formats formatList = m_Formats;
+  m_CancelToken.reset();
+  m_IOCounters.reset();
+  m_OpenIOStats = {};
 
   // Convert to long path if it's not already:
   std::filesystem::path filepath = IO::make_path(archiveName);
@@ -331,45 +484,230 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
   // need to hold on to the callback for now
   m_PasswordCallback = passwordCallback;
 
-  CComPtr<InputStream> file(new InputStream);
+  CComPtr<IInStream> file =
+      CountInput(OpenInputStream(filepath, m_OpenOptions), &m_IOCounters);
 
-  if (!file->Open(filepath)) {
+  if (!file) {
     m_LastError = Error::ERROR_FAILED_TO_OPEN_ARCHIVE;
     return false;
   }
 
+  m_ArchivePath = filepath;
+  m_Source.reset();
+  m_VolumeResolver = {};
+
   CComPtr<CArchiveOpenCallback> openCallbackPtr;
   try {
-    openCallbackPtr =
-        new CArchiveOpenCallback(passwordCallback, m_LogCallback, filepath);
+    m_Volumes       = std::make_shared<VolumeManager>(filepath);
+    openCallbackPtr = createOpenCallback();
   } catch (std::runtime_error const&) {
     m_LastError = Error::ERROR_FAILED_TO_OPEN_ARCHIVE;
     return false;
   }
 
+  bool opened = openArchive(file, openCallbackPtr, filepath.native());
+  if (opened) {
+    resetFileList();
+  }
+
+  m_OpenIOStats = m_IOCounters.snapshot();
+  return opened;
+}
+
+bool ArchiveImpl::openFromMemory(std::span<const std::byte> data,
+                                 std::wstring const& name,
+                                 PasswordCallback passwordCallback,
+                                 VolumeResolver volumeResolver)
+{
+  return openFromStream(std::make_shared<MemoryReader>(data), name, passwordCallback,
+                        std::move(volumeResolver));
+}
+
+bool ArchiveImpl::openFromStream(std::shared_ptr<ArchiveStreamReader> reader,
+                                 std::wstring const& name,
+                                 PasswordCallback passwordCallback,
+                                 VolumeResolver volumeResolver)
+{
+  auto guard = OpenTimer.instrument();
+  ArchiveTrace::Span span("open", "Open", ArchiveTrace::NO_ENTRY,
+                          std::filesystem::path(name).filename().native());
+  m_ArchiveName = name;
+  m_CancelToken.reset();
+  m_IOCounters.reset();
+  m_OpenIOStats = {};
+
+  if (!reader) {
+    m_LastError = Error::ERROR_FAILED_TO_OPEN_ARCHIVE;
+    return false;
+  }
+
+  m_PasswordCallback = passwordCallback;
+  m_ArchivePath      = name;
+  m_Source           = std::move(reader);
+  m_VolumeResolver   = std::move(volumeResolver);
+  m_Volumes.reset();
+
+  bool opened = false;
+  if (m_Source->isSequential()) {
+    opened = openSequential(name);
+  } else {
+    CComPtr<IInStream> file =
+        CountInput(new ReaderInputStream(m_Source), &m_IOCounters);
+    opened = openArchive(file, createOpenCallback(), name);
+  }
+  if (opened) {
+    resetFileList();
+  }
+
+  m_OpenIOStats = m_IOCounters.snapshot();
+  return opened;
+}
+
+// Lower-case extension of the given name, without the dot.
+static std::wstring extensionOf(std::wstring const& name)
+{
+  auto ext = std::filesystem::path(name).extension().native();
+  return ext.empty() ? ext : ArchiveStrings::towlower(ext.substr(1));
+}
+
+// Open the given handler on the given stream, timing the (often expensive) parsing
+// of the headers, and tracing which format is being tried.
+static HRESULT openHandler(IInArchive* handler, IInStream* file,
+                           IArchiveOpenCallback* openCallback,
+                           std::wstring_view formatName = {})
+{
+  auto guard = OpenHandlerTimer.instrument();
+  ArchiveTrace::Span span("open", "Open.Handler", ArchiveTrace::NO_ENTRY, formatName);
+  return handler->Open(file, 0, openCallback);
+}
+
+bool ArchiveImpl::openSequential(std::wstring const& name)
+{
+  // The stream cannot be rewound to try multiple handlers, so a single format is
+  // chosen from the signature, or from the extension if no signature matches:
+  std::string header(m_MaxSignatureLen, '\0');
+  std::size_t act = 0;
+  bool read = m_Source->read(0, header.data(), header.size(), &act);
+  IOCounters::add(m_IOCounters.readCalls, 1);
+  IOCounters::add(m_IOCounters.bytesRead, act);
+  if (!read) {
+    m_LastError = Error::ERROR_FAILED_TO_OPEN_ARCHIVE;
+    return false;
+  }
+  header.resize(act);
+
+  std::optional<ArchiveFormatInfo> format;
+  for (auto const& [signature, info] : m_SignatureMap) {
+    if (header.starts_with(signature)) {
+      format = info;
+      break;
+    }
+  }
+  if (!format) {
+    auto it = m_FormatMap.find(extensionOf(name));
+    if (it != m_FormatMap.end() && !it->second.empty()) {
+      format = it->second.front();
+    }
+  }
+  if (!format) {
+    m_LastError = Error::ERROR_INVALID_ARCHIVE_FORMAT;
+    return false;
+  }
+
+  CComPtr<IInArchive> handler;
+  if (!createHandler(format->m_ClassID, handler)) {
+    m_LastError = Error::ERROR_LIBRARY_ERROR;
+    return false;
+  }
+
+  CComPtr<IArchiveOpenSeq> openSeq;
+  if (handler->QueryInterface(IID_IArchiveOpenSeq, (void**)&openSeq) != S_OK) {
+    m_LogCallback(LogLevel::Warning,
+                  std::format(L"{} archives cannot be opened sequentially.",
+                              format->m_Name));
+    m_LastError = Error::ERROR_INVALID_ARCHIVE_FORMAT;
+    return false;
+  }
+
+  CComPtr<ISequentialInStream> stream(
+      new SequentialInputStream(m_Source, header, &m_IOCounters));
+  HRESULT result;
+  {
+    auto guard = OpenHandlerTimer.instrument();
+    ArchiveTrace::Span span("open", "Open.Handler", ArchiveTrace::NO_ENTRY,
+                            format->m_Name);
+    result = openSeq->OpenSeq(stream);
+  }
+  if (result != S_OK) {
+    m_LogCallback(LogLevel::Debug,
+                  std::format(L"Failed to open {} using {} (sequential).", name,
+                              format->m_Name));
+    m_LastError = Error::ERROR_INVALID_ARCHIVE_FORMAT;
+    return false;
+  }
+
+  // Some handlers (e.g. tar) only find their entries while extracting when opened
+  // sequentially, and do not report how many there are, so they cannot be listed:
+  UInt32 numItems = 0;
+  if (handler->GetNumberOfItems(&numItems) != S_OK ||
+      numItems == static_cast<UInt32>(-1)) {
+    m_LogCallback(LogLevel::Warning,
+                  std::format(L"{} archives cannot be listed when opened sequentially.",
+                              format->m_Name));
+    handler->Close();
+    m_LastError = Error::ERROR_INVALID_ARCHIVE_FORMAT;
+    return false;
+  }
+
+  m_LogCallback(LogLevel::Debug, std::format(L"Opened {} using {} (sequential).",
+                                             name, format->m_Name));
+  m_ArchivePtr     = handler;
+  m_HandlerClassID = format->m_ClassID;
+  m_Password.clear();
+  m_LastError = Error::ERROR_NONE;
+  return true;
+}
+
+CComPtr<CArchiveOpenCallback> ArchiveImpl::createOpenCallback()
+{
+  if (m_Source) {
+    return new CArchiveOpenCallback(m_PasswordCallback, m_LogCallback,
+                                    m_ArchivePath.native(), m_Source->getSize(),
+                                    m_VolumeResolver, &m_IOCounters, &m_CancelToken);
+  }
+
+  return new CArchiveOpenCallback(m_PasswordCallback, m_LogCallback, m_ArchivePath,
+                                  m_OpenOptions, m_Volumes, &m_IOCounters,
+                                  &m_CancelToken);
+}
+
+bool ArchiveImpl::openArchive(IInStream* file, CArchiveOpenCallback* openCallbackPtr,
+                              std::wstring const& archiveName)
+{
+  Formats formatList = m_Formats;
+
   // Try to open the archive
 
   bool sigMismatch = false;
 
   {
-    // Get the first iterator that is strictly > the signature we're looking for.
+    // Read the header of the file once, and look up the signatures in it:
+    std::string header(m_MaxSignatureLen, '\0');
+    UInt32 act = 0;
+    file->Seek(0, STREAM_SEEK_SET, nullptr);
+    file->Read(header.data(), static_cast<UInt32>(header.size()), &act);
+    file->Seek(0, STREAM_SEEK_SET, nullptr);
+    header.resize(act);
+
     for (auto signatureInfo : m_SignatureMap) {
-      // Read the signature of the file and look that up.
-      std::vector<char> buff;
-      buff.reserve(m_MaxSignatureLen);
-      UInt32 act;
-      file->Seek(0, STREAM_SEEK_SET, nullptr);
-      file->Read(buff.data(), static_cast<UInt32>(m_MaxSignatureLen), &act);
-      file->Seek(0, STREAM_SEEK_SET, nullptr);
-      std::string signature = std::string(buff.data(), act);
-      if (signatureInfo.first == std::string(buff.data(), signatureInfo.first.size())) {
-        if (m_CreateObjectFunc(&signatureInfo.second.m_ClassID, &IID_IInArchive,
-                               (void**)&m_ArchivePtr) != S_OK) {
+      if (header.starts_with(signatureInfo.first)) {
+        if (!createHandler(signatureInfo.second.m_ClassID, m_ArchivePtr)) {
           m_LastError = Error::ERROR_LIBRARY_ERROR;
           return false;
         }
 
-        if (m_ArchivePtr->Open(file, 0, openCallbackPtr) != S_OK) {
+        if (openHandler(m_ArchivePtr, file, openCallbackPtr,
+                        signatureInfo.second.m_Name) != S_OK) {
           m_LogCallback(LogLevel::Debug,
                         std::format(L"Failed to open {} using {} (from signature).",
                                     archiveName, signatureInfo.second.m_Name));
@@ -378,10 +716,9 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
           m_LogCallback(LogLevel::Debug,
                         std::format(L"Opened {} using {} (from signature).",
                                     archiveName, signatureInfo.second.m_Name));
+          m_HandlerClassID = signatureInfo.second.m_ClassID;
 
-          // Retrieve the extension (warning: .extension() contains the dot):
-          std::wstring ext =
-              ArchiveStrings::towlower(filepath.extension().native().substr(1));
+          std::wstring ext = extensionOf(archiveName);
           std::wistringstream s(signatureInfo.second.m_Extensions);
           std::wstring t;
           bool found = false;
@@ -414,9 +751,8 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
 
   {
     // determine archive type based on extension
-    Formats const* formats = nullptr;
-    std::wstring ext =
-        ArchiveStrings::towlower(filepath.extension().native().substr(1));
+    Formats const* formats             = nullptr;
+    std::wstring ext                   = extensionOf(archiveName);
     FormatMap::const_iterator map_iter = m_FormatMap.find(ext);
     if (map_iter != m_FormatMap.end()) {
       formats = &map_iter->second;
@@ -425,13 +761,13 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
           // OK, we have some potential formats. If there is only one, try it now. If
           // there are multiple formats, we'll try by signature lookup first.
           for (ArchiveFormatInfo format : *formats) {
-            if (m_CreateObjectFunc(&format.m_ClassID, &IID_IInArchive,
-                                   (void**)&m_ArchivePtr) != S_OK) {
+            if (!createHandler(format.m_ClassID, m_ArchivePtr)) {
               m_LastError = Error::ERROR_LIBRARY_ERROR;
               return false;
             }
 
-            if (m_ArchivePtr->Open(file, 0, openCallbackPtr) != S_OK) {
+            if (openHandler(m_ArchivePtr, file, openCallbackPtr, format.m_Name) !=
+                S_OK) {
               m_LogCallback(LogLevel::Debug,
                             std::format(L"Failed to open {} using {} (from signature).",
                                         archiveName, format.m_Name));
@@ -440,6 +776,7 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
               m_LogCallback(LogLevel::Debug,
                             std::format(L"Opened {} using {} (from signature).",
                                         archiveName, format.m_Name));
+              m_HandlerClassID = format.m_ClassID;
               break;
             }
 
@@ -464,6 +801,11 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
     }
   }
 
+  if (m_ArchivePtr == nullptr && m_CancelToken.isCanceled()) {
+    m_LastError = Error::ERROR_OPEN_CANCELLED;
+    return false;
+  }
+
   if (m_ArchivePtr == nullptr) {
     m_LogCallback(LogLevel::Warning, L"Trying to open an archive but could not "
                                      L"recognize the extension or signature.");
@@ -471,17 +813,17 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
         LogLevel::Debug,
         L"Attempting to open the file with the remaining formats as a fallback...");
     for (auto format : formatList) {
-      if (m_CreateObjectFunc(&format.m_ClassID, &IID_IInArchive,
-                             (void**)&m_ArchivePtr) != S_OK) {
+      if (!createHandler(format.m_ClassID, m_ArchivePtr)) {
         m_LastError = Error::ERROR_LIBRARY_ERROR;
         return false;
       }
-      if (m_ArchivePtr->Open(file, 0, openCallbackPtr) == S_OK) {
+      if (openHandler(m_ArchivePtr, file, openCallbackPtr, format.m_Name) == S_OK) {
         m_LogCallback(LogLevel::Debug,
                       std::format(L"Opened {} using {} (from signature).", archiveName,
                                   format.m_Name));
         m_LogCallback(LogLevel::Warning,
                       L"This archive likely has an incorrect extension.");
+        m_HandlerClassID = format.m_ClassID;
         break;
       } else
         m_ArchivePtr.Release();
@@ -489,7 +831,8 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
   }
 
   if (m_ArchivePtr == nullptr) {
-    m_LastError = Error::ERROR_INVALID_ARCHIVE_FORMAT;
+    m_LastError = m_CancelToken.isCanceled() ? Error::ERROR_OPEN_CANCELLED
+                                             : Error::ERROR_INVALID_ARCHIVE_FORMAT;
     return false;
   }
 
@@ -518,8 +861,6 @@ bool ArchiveImpl::open(std::wstring const& archiveName,
     }*/
 
   m_LastError = Error::ERROR_NONE;
-
-  resetFileList();
   return true;
 }
 
@@ -530,9 +871,65 @@ void ArchiveImpl::close()
   }
   clearFileList();
   m_ArchivePtr.Release();
+  m_Volumes.reset();
+  m_Source.reset();
+  m_VolumeResolver   = {};
   m_PasswordCallback = {};
 }
 
+bool ArchiveImpl::createHandler(GUID const& classID,
+                                CComPtr<IInArchive>& handler) const
+{
+  if (m_CreateObjectFunc(&classID, &IID_IInArchive, (void**)&handler) != S_OK) {
+    return false;
+  }
+
+  // PropertyVariant cannot be copied safely, so the vector must never reallocate:
+  std::vector<std::wstring> names;
+  std::vector<PropertyVariant> values;
+  values.reserve(m_HandlerOptions.properties.size() + 2);
+  if (m_HandlerOptions.threads > 0) {
+    names.push_back(L"mt");
+    values.emplace_back() = m_HandlerOptions.threads;
+  }
+  if (m_HandlerOptions.memoryUsage > 0) {
+    names.push_back(L"memuse");
+    values.emplace_back() = std::format(L"{}b", m_HandlerOptions.memoryUsage);
+  }
+  for (auto const& [name, value] : m_HandlerOptions.properties) {
+    names.push_back(name);
+    values.emplace_back() = value;
+  }
+
+  if (names.empty()) {
+    return true;
+  }
+
+  // Not all handlers accept properties, and the ones that do ignore the ones they do
+  // not know, so failing here is not an error:
+  CComPtr<ISetProperties> setProperties;
+  handler->QueryInterface(IID_ISetProperties, (void**)&setProperties);
+  if (!setProperties) {
+    m_LogCallback(LogLevel::Debug, L"Handler does not accept properties.");
+    return true;
+  }
+
+  std::vector<const wchar_t*> namePtrs;
+  for (auto const& name : names) {
+    namePtrs.push_back(name.c_str());
+  }
+
+  HRESULT result = setProperties->SetProperties(namePtrs.data(), values.data(),
+                                                static_cast<UInt32>(values.size()));
+  if (result != S_OK) {
+    m_LogCallback(LogLevel::Warning,
+                  std::format(L"Failed to set handler properties: {:#x}.",
+                              static_cast<unsigned long>(result)));
+  }
+
+  return true;
+}
+
 void ArchiveImpl::clearFileList()
 {
   for (std::vector<FileData*>::iterator iter = m_FileList.begin();
@@ -544,6 +941,9 @@ void ArchiveImpl::clearFileList()
 
 void ArchiveImpl::resetFileList()
 {
+  auto guard = ResetFileListTimer.instrument();
+  ArchiveTrace::Span span("open", "ResetFileList");
+
   UInt32 numItems = 0;
   clearFileList();
 
@@ -556,30 +956,141 @@ void ArchiveImpl::resetFileList()
   }
 }
 
+std::unique_ptr<ArchiveEntryReader> ArchiveImpl::openEntry(std::size_t index)
+{
+  if (m_ArchivePtr == nullptr || index >= m_FileList.size() ||
+      m_FileList[index]->isDirectory()) {
+    m_LastError = Error::ERROR_INVALID_ENTRY;
+    return nullptr;
+  }
+
+  // Readers extract their entry again for every chunk that is not cached, which a
+  // sequential source that has already been consumed cannot do:
+  if (m_Source && m_Source->isSequential()) {
+    m_LogCallback(LogLevel::Error,
+                  L"Entries of archives opened from a sequential stream cannot be "
+                  L"opened individually.");
+    m_LastError = Error::ERROR_INVALID_ENTRY;
+    return nullptr;
+  }
+
+  m_LastError = Error::ERROR_NONE;
+  return std::make_unique<EntryReader>(
+      m_ArchivePtr, static_cast<UInt32>(index), m_FileList[index]->getSize(),
+      m_PasswordCallback, m_LogCallback, m_Password);
+}
+
 bool ArchiveImpl::extract(std::wstring const& outputDirectory,
                           ProgressCallback progressCallback,
                           FileChangeCallback fileChangeCallback,
                           ErrorCallback errorCallback)
 
 {
+  m_CancelToken.reset();
+
   // Retrieve the list of indices we want to extract:
   std::vector<UInt32> indices;
   UInt64 totalSize = 0;
   for (std::size_t i = 0; i < m_FileList.size(); ++i) {
     FileDataImpl* fileData = static_cast<FileDataImpl*>(m_FileList[i]);
+    fileData->setContentHash({});
     if (!fileData->isEmpty()) {
       indices.push_back(static_cast<UInt32>(i));
       totalSize += fileData->getSize();
     }
   }
 
-  m_ExtractCallback = new CArchiveExtractCallback(
-      progressCallback, fileChangeCallback, errorCallback, m_PasswordCallback,
-      m_LogCallback, m_ArchivePtr, outputDirectory, &m_FileList[0], m_FileList.size(),
-      totalSize, &m_Password);
-  HRESULT result = m_ArchivePtr->Extract(
-      indices.data(), static_cast<UInt32>(indices.size()), false, m_ExtractCallback);
-  // Note: m_ExtractCallBack is deleted by Extract
+  if (m_ExtractOptions.checkFreeSpace &&
+      !checkFreeSpace(IO::make_path(outputDirectory), errorCallback)) {
+    m_LastError = Error::ERROR_NOT_ENOUGH_SPACE;
+    return false;
+  }
+
+  m_ProgressState.reset();
+  m_IOCounters.reset();
+  m_ExtractIOStats = {};
+
+  // Fail now rather than running out of memory in the middle of the extraction:
+  auto estimate  = estimateExtractionMemory();
+  m_MemoryReport = {estimate.decoderBytes, 0, 0};
+  // The decoders must leave something, since a budget of 0 for the buffers would
+  // mean no limit at all:
+  if (m_ExtractOptions.memoryBudget > 0 &&
+      estimate.decoderBytes >= m_ExtractOptions.memoryBudget) {
+    m_LogCallback(LogLevel::Error,
+                  std::format(L"Extraction requires {} bytes for decoding, which "
+                              L"leaves nothing of the memory budget of {} bytes.",
+                              estimate.decoderBytes, m_ExtractOptions.memoryBudget));
+    m_LastError = Error::ERROR_OUT_OF_MEMORY;
+    return false;
+  }
+
+  // The buffers get whatever the decoders do not use:
+  MemoryBudget memoryBudget(m_ExtractOptions.memoryBudget > 0
+                                ? m_ExtractOptions.memoryBudget - estimate.decoderBytes
+                                : 0);
+
+  // Wait for our turn if the output volume is busy with other extractions:
+  std::shared_ptr<ExtractionScheduler::Job> schedulerJob;
+  if (m_ExtractOptions.useSharedScheduler) {
+    schedulerJob = ExtractionScheduler::instance().join(IO::make_path(outputDirectory),
+                                                        m_CancelToken);
+    if (!schedulerJob) {
+      m_LastError = Error::ERROR_EXTRACT_CANCELLED;
+      return false;
+    }
+  }
+
+  // Priority entries are extracted first, with a separate call:
+  auto groups = groupByPriority(indices);
+
+  std::vector<UInt32> order;
+  for (auto const& group : groups) {
+    order.insert(order.end(), group.begin(), group.end());
+  }
+
+  CArchiveExtractCallback::HashCallback hashCallback;
+  if (m_ExtractOptions.computeHashes) {
+    hashCallback = [this](UInt32 index, FileData::ContentHash const& hash) {
+      static_cast<FileDataImpl*>(m_FileList[index])->setContentHash(hash);
+    };
+  }
+
+  // Keep a reference on the callback: files may still be pending when Extract()
+  // returns, and we need to wait for them.
+  CComPtr<CArchiveExtractCallback> extractCallback(new CArchiveExtractCallback(
+      progressCallback, m_ProgressStatsCallback, fileChangeCallback, errorCallback,
+      m_PasswordCallback, m_LogCallback, m_ArchivePtr, outputDirectory, &m_FileList[0],
+      m_FileList.size(), order, totalSize, &m_Password, m_ExtractOptions,
+      &m_ProgressState, &m_CancelToken, schedulerJob, &memoryBudget, &m_IOCounters,
+      hashCallback));
+
+  // The groups are a partition of the selected entries:
+  UInt64 remainingSize = totalSize;
+  HRESULT result       = S_OK;
+  for (auto const& group : groups) {
+    for (auto index : group) {
+      remainingSize -= m_FileList[index]->getSize();
+    }
+
+    extractCallback->StartGroup(remainingSize);
+    result = m_ArchivePtr->Extract(group.data(), static_cast<UInt32>(group.size()),
+                                   false, extractCallback);
+    if (result != S_OK) {
+      break;
+    }
+  }
+
+  HRESULT finishResult = extractCallback->Finish();
+  if (result == S_OK) {
+    result = finishResult;
+  }
+
+  memoryBudget.sample();
+  m_MemoryReport.bufferBytes  = memoryBudget.peak();
+  m_MemoryReport.processBytes = memoryBudget.processPeak();
+  m_ExtractIOStats            = m_IOCounters.snapshot();
+
   switch (result) {
   case S_OK: {
     // nop
@@ -598,12 +1109,434 @@ bool ArchiveImpl::extract(std::wstring const& outputDirectory,
   return result == S_OK;
 }
 
+bool ArchiveImpl::test(ErrorCallback errorCallback)
+{
+  if (m_ArchivePtr == nullptr) {
+    m_LastError = Error::ERROR_ARCHIVE_INVALID;
+    return false;
+  }
+
+  m_CancelToken.reset();
+  m_IOCounters.reset();
+
+  std::vector<UInt32> indices;
+  for (std::size_t i = 0; i < m_FileList.size(); ++i) {
+    if (!m_FileList[i]->isDirectory()) {
+      indices.push_back(static_cast<UInt32>(i));
+    }
+  }
+
+  // The callbacks may be called from multiple threads, and the password must only
+  // be asked once:
+  std::mutex mutex;
+  bool failed = false;
+
+  auto passwordCallback = [&]() {
+    std::scoped_lock lock(mutex);
+    if (m_Password.empty() && m_PasswordCallback) {
+      m_Password = m_PasswordCallback();
+    }
+    return m_Password;
+  };
+
+  auto reportError = [&](UInt32 index, std::wstring const& message) {
+    auto path = m_FileList[index]->getArchiveFilePath();
+
+    std::scoped_lock lock(mutex);
+    failed = true;
+    m_LogCallback(LogLevel::Error,
+                  std::format(L"Test of {} failed: {}.", path, message));
+    if (errorCallback) {
+      errorCallback(std::format(L"{}: {}", path, message));
+    }
+  };
+
+  std::size_t nThreads = m_ExtractOptions.testThreads > 0
+                             ? m_ExtractOptions.testThreads
+                             : std::max(1u, std::thread::hardware_concurrency());
+  nThreads             = std::min(nThreads, indices.size());
+
+  // Entries of a solid block can only be decoded in order, so splitting them across
+  // handlers would decode the same data multiple times, and sequential sources can
+  // only be read by one handler:
+  HRESULT result = S_OK;
+  if (nThreads <= 1 || isSolid() || (m_Source && m_Source->isSequential())) {
+    result = testEntries(m_ArchivePtr, indices, reportError, passwordCallback);
+  } else {
+    // Each thread needs its own handler (and input stream) since handlers are not
+    // thread-safe, but the streams can share a single handle (and cache):
+    std::shared_ptr<SharedFile> sharedFile;
+    if (!m_Source) {
+      sharedFile = SharedFile::Open(m_ArchivePath, m_OpenOptions.sharedCacheSize);
+    }
+
+    std::vector<CComPtr<IInArchive>> handlers{m_ArchivePtr};
+    while (handlers.size() < nThreads) {
+      auto handler = openHandlerInstance(sharedFile);
+      if (handler == nullptr) {
+        break;
+      }
+      handlers.push_back(handler);
+    }
+
+    // Contiguous slices of roughly equal size, since handlers read entries faster
+    // in archive order:
+    UInt64 totalSize = 0;
+    for (auto index : indices) {
+      totalSize += m_FileList[index]->getSize();
+    }
+
+    std::vector<std::vector<UInt32>> slices(handlers.size());
+    UInt64 sliceSize = totalSize / handlers.size() + 1, currentSize = 0;
+    for (std::size_t i = 0, slice = 0; i < indices.size(); ++i) {
+      // Keep enough entries for the remaining slices:
+      if (currentSize >= sliceSize && slice + 1 < slices.size() &&
+          indices.size() - i >= slices.size() - slice - 1) {
+        slice++;
+        currentSize = 0;
+      }
+      slices[slice].push_back(indices[i]);
+      currentSize += m_FileList[indices[i]]->getSize();
+    }
+
+    std::vector<HRESULT> results(handlers.size(), S_OK);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < handlers.size(); ++i) {
+      threads.emplace_back([&, i] {
+        results[i] = testEntries(handlers[i], slices[i], reportError, passwordCallback);
+      });
+    }
+    results[0] = testEntries(handlers[0], slices[0], reportError, passwordCallback);
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (std::size_t i = 1; i < handlers.size(); ++i) {
+      handlers[i]->Close();
+    }
+
+    auto it = std::find_if(results.begin(), results.end(), [](HRESULT r) {
+      return r != S_OK;
+    });
+    if (it != results.end()) {
+      result = *it;
+    }
+  }
+
+  m_ExtractIOStats = m_IOCounters.snapshot();
+
+  switch (result) {
+  case S_OK: {
+    if (failed) {
+      m_LastError = Error::ERROR_ARCHIVE_INVALID;
+    }
+  } break;
+  case E_ABORT: {
+    m_LastError = Error::ERROR_EXTRACT_CANCELLED;
+  } break;
+  case E_OUTOFMEMORY: {
+    m_LastError = Error::ERROR_OUT_OF_MEMORY;
+  } break;
+  default: {
+    m_LastError = Error::ERROR_LIBRARY_ERROR;
+  } break;
+  }
+
+  return result == S_OK && !failed;
+}
+
+CComPtr<IInArchive>
+ArchiveImpl::openHandlerInstance(std::shared_ptr<SharedFile> const& sharedFile)
+{
+  CComPtr<IInStream> file;
+  if (m_Source) {
+    file = new ReaderInputStream(m_Source);
+  } else if (sharedFile) {
+    file = new PositionalInputStream(sharedFile);
+  } else {
+    file = OpenInputStream(m_ArchivePath, m_OpenOptions);
+  }
+  if (!file) {
+    return nullptr;
+  }
+  file = CountInput(file, &m_IOCounters);
+
+  CComPtr<CArchiveOpenCallback> openCallbackPtr;
+  try {
+    openCallbackPtr = createOpenCallback();
+  } catch (std::runtime_error const&) {
+    return nullptr;
+  }
+
+  CComPtr<IInArchive> handler;
+  if (!createHandler(m_HandlerClassID, handler) ||
+      openHandler(handler, file, openCallbackPtr) != S_OK) {
+    m_LogCallback(LogLevel::Debug,
+                  std::format(L"Failed to open another instance of {}.",
+                              m_ArchiveName));
+    return nullptr;
+  }
+
+  return handler;
+}
+
+HRESULT
+ArchiveImpl::testEntries(IInArchive* handler, std::vector<UInt32> const& indices,
+                         CArchiveTestCallback::ErrorCallback const& errorCallback,
+                         Archive::PasswordCallback const& passwordCallback)
+{
+  if (indices.empty()) {
+    return S_OK;
+  }
+
+  CComPtr<CArchiveTestCallback> testCallback(
+      new CArchiveTestCallback(errorCallback, passwordCallback, &m_CancelToken));
+  return handler->Extract(indices.data(), static_cast<UInt32>(indices.size()),
+                          1 /* testMode */, testCallback);
+}
+
+bool ArchiveImpl::isSolid() const
+{
+  PropertyVariant prop;
+  if (m_ArchivePtr == nullptr ||
+      m_ArchivePtr->GetArchiveProperty(kpidSolid, &prop) != S_OK) {
+    return false;
+  }
+  return static_cast<bool>(prop);
+}
+
+std::optional<UInt32> ArchiveImpl::blockOf(UInt32 index) const
+{
+  PropertyVariant prop;
+  if (m_ArchivePtr->GetProperty(index, kpidBlock, &prop) != S_OK || prop.is_empty()) {
+    return {};
+  }
+  return static_cast<UInt32>(prop);
+}
+
+std::vector<uint32_t> ArchiveImpl::getPriorityBlocks() const
+{
+  if (!isSolid()) {
+    return {};
+  }
+
+  std::set<uint32_t> blocks;
+  for (std::size_t i = 0; i < m_FileList.size(); ++i) {
+    auto* fileData = static_cast<FileDataImpl*>(m_FileList[i]);
+    if (fileData->isEmpty() || !fileData->hasPriority()) {
+      continue;
+    }
+
+    auto block = blockOf(static_cast<UInt32>(i));
+    if (!block) {
+      return {};
+    }
+    blocks.insert(*block);
+  }
+
+  return {blocks.begin(), blocks.end()};
+}
+
+std::vector<std::vector<UInt32>>
+ArchiveImpl::groupByPriority(std::vector<UInt32> const& indices)
+{
+  const bool hasPriority = std::any_of(indices.begin(), indices.end(), [&](UInt32 i) {
+    return m_FileList[i]->hasPriority();
+  });
+  if (!hasPriority) {
+    return {indices};
+  }
+
+  // Every group requires its own call to Extract(), but a sequential source can only
+  // be read once:
+  if (m_Source && m_Source->isSequential()) {
+    m_LogCallback(LogLevel::Info, L"The archive is read sequentially, priority "
+                                  L"entries are ignored.");
+    return {indices};
+  }
+
+  // In a solid archive, extracting an entry requires decoding the block that contains
+  // it up to that entry, so we extract the whole blocks first instead:
+  std::function<bool(UInt32)> isFirst = [this](UInt32 index) {
+    return m_FileList[index]->hasPriority();
+  };
+
+  if (isSolid()) {
+    auto blocks = getPriorityBlocks();
+    if (blocks.empty()) {
+      m_LogCallback(LogLevel::Info, L"The archive is solid and does not report its "
+                                    L"blocks, priority entries are ignored.");
+      return {indices};
+    }
+
+    std::vector<std::wstring> names;
+    for (auto block : blocks) {
+      names.push_back(std::to_wstring(block));
+    }
+    m_LogCallback(LogLevel::Info,
+                  std::format(L"Priority entries are in solid block(s) {}.",
+                              ArchiveStrings::join(names, L", ")));
+
+    isFirst = [this, blocks = std::set<UInt32>(blocks.begin(), blocks.end())](
+                  UInt32 index) {
+      auto block = blockOf(index);
+      return block && blocks.contains(*block);
+    };
+  }
+
+  // Extract() requires sorted indices, which each group keeps:
+  std::vector<UInt32> first, rest;
+  for (auto index : indices) {
+    (isFirst(index) ? first : rest).push_back(index);
+  }
+
+  if (rest.empty()) {
+    return {first};
+  }
+
+  return {first, rest};
+}
+
+Archive::MemoryUsage ArchiveImpl::estimateExtractionMemory() const
+{
+  MemoryUsage usage{};
+  if (m_ArchivePtr == nullptr) {
+    return usage;
+  }
+
+  // Entries are decoded one after the other, so only the largest decoder counts:
+  for (std::size_t i = 0; i < m_FileList.size(); ++i) {
+    if (static_cast<FileDataImpl*>(m_FileList[i])->isEmpty()) {
+      continue;
+    }
+
+    try {
+      usage.decoderBytes = std::max(
+          usage.decoderBytes,
+          EstimateDecoderMemory(readProperty<std::wstring>(static_cast<UInt32>(i),
+                                                           kpidMethod)));
+    } catch (std::exception const&) {
+      // Not all formats report the method.
+    }
+  }
+
+  usage.bufferBytes = CArchiveExtractCallback::EstimateBufferMemory(
+      m_ExtractOptions, m_FileList.data(), m_FileList.size());
+
+  return usage;
+}
+
+bool ArchiveImpl::checkFreeSpace(std::filesystem::path const& outputDirectory,
+                                 ErrorCallback const& errorCallback) const
+{
+  namespace fs = std::filesystem;
+
+  // An entry is written once for each of its output paths, but the same path can be
+  // given more than once, in which case the file is only written once:
+  UInt64 requiredSize = 0;
+  for (auto* fileData : m_FileList) {
+    if (fileData->isDirectory()) {
+      continue;
+    }
+    std::set<std::wstring> paths;
+    for (auto const& filepath : fileData->getOutputFilePaths()) {
+      paths.insert(ArchiveStrings::towlower(filepath));
+    }
+    requiredSize += fileData->getSize() * paths.size();
+  }
+
+  if (requiredSize == 0) {
+    return true;
+  }
+
+  // The output directory is usually created by the extraction, so we look for the
+  // closest existing parent:
+  std::error_code ec;
+  fs::path directory = outputDirectory;
+  while (!fs::exists(directory, ec) && directory.has_parent_path() &&
+         directory.parent_path() != directory) {
+    directory = directory.parent_path();
+  }
+
+  auto space = fs::space(directory, ec);
+  if (ec) {
+    // Not being able to check is not a reason to fail the extraction:
+    m_LogCallback(LogLevel::Warning,
+                  std::format(L"Failed to check free space on '{}': {}.", directory, ec));
+    return true;
+  }
+
+  if (requiredSize <= space.available) {
+    return true;
+  }
+
+  // Files that already exist are replaced, so the space they use will be freed. This
+  // is only checked here because it requires looking at every output file:
+  for (auto* fileData : m_FileList) {
+    if (fileData->isDirectory()) {
+      continue;
+    }
+    for (auto const& filepath : fileData->getOutputFilePaths()) {
+      auto size = fs::file_size(outputDirectory / fs::path(filepath).make_preferred(), ec);
+      if (!ec) {
+        requiredSize -= std::min<UInt64>(requiredSize, size);
+      }
+    }
+  }
+
+  if (requiredSize <= space.available) {
+    return true;
+  }
+
+  if (errorCallback) {
+    errorCallback(std::format(
+        L"not enough space on the disk containing '{}': {} bytes required, {} available",
+        outputDirectory, requiredSize, space.available));
+  }
+  return false;
+}
+
 void ArchiveImpl::cancel()
 {
-  m_ExtractCallback->SetCanceled(true);
+  m_CancelToken.cancel();
 }
 
 std::unique_ptr<Archive> CreateArchive()
 {
   return std::make_unique<ArchiveImpl>();
 }
+
+void ConfigureExtractionScheduler(Archive::SchedulerOptions const& options)
+{
+  ExtractionScheduler::configure(options);
+}
+
+void EnableInstrumentation(bool enabled)
+{
+  ArchiveTimers::setEnabled(enabled);
+}
+
+std::vector<Archive::TimerStats> GetInstrumentationReport()
+{
+  return ArchiveTimers::report();
+}
+
+void ResetInstrumentation()
+{
+  ArchiveTimers::reset();
+}
+
+void StartTracing()
+{
+  ArchiveTrace::start();
+}
+
+void StopTracing()
+{
+  ArchiveTrace::stop();
+}
+
+std::string ExportTrace()
+{
+  return ArchiveTrace::exportJson();
+}
@@ -0,0 +1,50 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_CANCELLATION_H
+#define ARCHIVE_CANCELLATION_H
+
+#include <atomic>
+
+/**
+ * Cancellation flag shared between the archive and the objects working on its
+ * behalf (callbacks, streams).
+ *
+ * The token is owned by the archive, so it outlives every operation and cancel()
+ * can be called from any thread at any time. Workers poll isCanceled() at points
+ * that are reached frequently (e.g., every write), which bounds the time it takes
+ * for an operation to stop.
+ */
+class CancellationToken
+{
+public:
+  void cancel() noexcept { m_Canceled.store(true, std::memory_order_relaxed); }
+  void reset() noexcept { m_Canceled.store(false, std::memory_order_relaxed); }
+
+  bool isCanceled() const noexcept
+  {
+    return m_Canceled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> m_Canceled{false};
+};
+
+#endif
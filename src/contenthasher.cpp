@@ -0,0 +1,60 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "contenthasher.h"
+
+#include <cstring>
+#include <new>
+
+#include <xxhash.h>
+
+ContentHasher::ContentHasher() : m_State(XXH3_createState())
+{
+  if (m_State == nullptr) {
+    throw std::bad_alloc();
+  }
+  reset();
+}
+
+ContentHasher::~ContentHasher()
+{
+  XXH3_freeState(m_State);
+}
+
+void ContentHasher::reset()
+{
+  XXH3_128bits_reset(m_State);
+}
+
+void ContentHasher::update(const void* data, std::size_t size)
+{
+  XXH3_128bits_update(m_State, data, size);
+}
+
+FileData::ContentHash ContentHasher::digest() const
+{
+  XXH128_canonical_t canonical;
+  XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(m_State));
+
+  FileData::ContentHash hash;
+  static_assert(sizeof(hash) == sizeof(canonical.digest));
+  std::memcpy(hash.data(), canonical.digest, hash.size());
+  return hash;
+}
@@ -0,0 +1,63 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_CONTENTHASHER_H
+#define ARCHIVE_CONTENTHASHER_H
+
+#include <cstddef>
+
+#include "archive.h"
+
+struct XXH3_state_s;
+
+/**
+ * Incremental XXH3 128-bit hasher, used to hash the content of entries as they are
+ * written. XXH3 selects the fastest vector instructions available at runtime.
+ */
+class ContentHasher
+{
+public:
+  ContentHasher();
+  ~ContentHasher();
+
+  ContentHasher(ContentHasher const&)            = delete;
+  ContentHasher& operator=(ContentHasher const&) = delete;
+
+  /**
+   * @brief Start a new hash, discarding the current one.
+   */
+  void reset();
+
+  /**
+   * @brief Add the given data to the current hash.
+   */
+  void update(const void* data, std::size_t size);
+
+  /**
+   * @return the hash of the data added since the last reset(), in canonical
+   *   (big-endian) order.
+   */
+  FileData::ContentHash digest() const;
+
+private:
+  XXH3_state_s* m_State;
+};
+
+#endif
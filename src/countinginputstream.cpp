@@ -0,0 +1,80 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "countinginputstream.h"
+#include <Unknwn.h>
+
+#include <utility>
+
+CountingInputStream::CountingInputStream(CComPtr<IInStream> stream,
+                                         IOCounters* counters)
+    : m_Stream(std::move(stream)), m_Counters(counters), m_Position(0)
+{}
+
+CountingInputStream::~CountingInputStream() {}
+
+STDMETHODIMP CountingInputStream::Read(void* data, UInt32 size, UInt32* processedSize)
+{
+  UInt32 realProcessedSize = 0;
+  HRESULT result           = m_Stream->Read(data, size, &realProcessedSize);
+
+  IOCounters::add(m_Counters->readCalls, 1);
+  IOCounters::add(m_Counters->bytesRead, realProcessedSize);
+  if (realProcessedSize > 0) {
+    UInt64 end = m_Position + realProcessedSize;
+    IOCounters::add(m_Counters->bytesReread, m_ReadRanges.overlap(m_Position, end));
+    m_ReadRanges.insert(m_Position, end);
+    m_Position = end;
+  }
+
+  if (processedSize != nullptr) {
+    *processedSize = realProcessedSize;
+  }
+  return result;
+}
+
+STDMETHODIMP CountingInputStream::Seek(Int64 offset, UInt32 seekOrigin,
+                                       UInt64* newPosition)
+{
+  UInt64 realNewPosition = 0;
+  HRESULT result         = m_Stream->Seek(offset, seekOrigin, &realNewPosition);
+  if (result != S_OK) {
+    return result;
+  }
+
+  // Handlers often seek only to retrieve the current position, which is not counted:
+  if (realNewPosition != m_Position) {
+    IOCounters::add(m_Counters->seeks, 1);
+    m_Position = realNewPosition;
+  }
+
+  if (newPosition) {
+    *newPosition = realNewPosition;
+  }
+  return S_OK;
+}
+
+CComPtr<IInStream> CountInput(CComPtr<IInStream> stream, IOCounters* counters)
+{
+  if (!stream || counters == nullptr) {
+    return stream;
+  }
+  return new CountingInputStream(std::move(stream), counters);
+}
@@ -0,0 +1,62 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_COUNTINGINPUTSTREAM_H
+#define ARCHIVE_COUNTINGINPUTSTREAM_H
+
+#include "7zip/IStream.h"
+
+#include <atlbase.h>
+
+#include "iocounters.h"
+#include "rangeset.h"
+#include "unknown_impl.h"
+
+/** This class implements an input stream that counts the I/O of another stream
+ *
+ * Bytes are counted as re-read when this stream has already read them, i.e. when
+ * they are read again after seeking backward.
+ */
+class CountingInputStream : public IInStream
+{
+
+  UNKNOWN_1_INTERFACE(IInStream);
+
+public:
+  CountingInputStream(CComPtr<IInStream> stream, IOCounters* counters);
+
+  virtual ~CountingInputStream();
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+private:
+  CComPtr<IInStream> m_Stream;
+  IOCounters* m_Counters;
+  UInt64 m_Position;
+  RangeSet m_ReadRanges;
+};
+
+/** Wrap the given stream in a CountingInputStream, unless the stream or the counters
+ * are null
+ */
+CComPtr<IInStream> CountInput(CComPtr<IInStream> stream, IOCounters* counters);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "crc32.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define ARCHIVE_CRC32_PCLMUL
+#elif defined(_M_ARM64)
+#include <Windows.h>
+#include <arm64intr.h>
+#define ARCHIVE_CRC32_ARM
+#endif
+
+namespace
+{
+
+// Reflected polynomial of CRC32.
+constexpr uint32_t POLYNOMIAL = 0xEDB88320;
+
+// Tables for slicing-by-8: TABLES[k][b] is the CRC of byte b followed by k zero bytes.
+constexpr auto TABLES = [] {
+  std::array<std::array<uint32_t, 256>, 8> tables{};
+  for (uint32_t b = 0; b < 256; ++b) {
+    uint32_t crc = b;
+    for (int i = 0; i < 8; ++i) {
+      crc = (crc >> 1) ^ (POLYNOMIAL & (0 - (crc & 1)));
+    }
+    tables[0][b] = crc;
+  }
+  for (uint32_t b = 0; b < 256; ++b) {
+    for (std::size_t k = 1; k < tables.size(); ++k) {
+      tables[k][b] = (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xFF];
+    }
+  }
+  return tables;
+}();
+
+uint32_t UpdateSlicing8(uint32_t crc, const unsigned char* data, std::size_t size)
+{
+  while (size >= 8) {
+    uint32_t low, high;
+    std::memcpy(&low, data, 4);
+    std::memcpy(&high, data + 4, 4);
+    low ^= crc;
+    crc = TABLES[7][low & 0xFF] ^ TABLES[6][(low >> 8) & 0xFF] ^
+          TABLES[5][(low >> 16) & 0xFF] ^ TABLES[4][low >> 24] ^
+          TABLES[3][high & 0xFF] ^ TABLES[2][(high >> 8) & 0xFF] ^
+          TABLES[1][(high >> 16) & 0xFF] ^ TABLES[0][high >> 24];
+    data += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = (crc >> 8) ^ TABLES[0][(crc ^ *data++) & 0xFF];
+  }
+  return crc;
+}
+
+#if defined(ARCHIVE_CRC32_PCLMUL)
+
+// Folds 64 bytes at a time with carry-less multiplications, then reduces the result
+// with a Barrett reduction, see "Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ Instruction" (Intel). The constants are powers of x modulo the
+// (reflected) polynomial.
+uint32_t UpdatePclmul(uint32_t crc, const unsigned char* data, std::size_t size)
+{
+  if (size < 64) {
+    return UpdateSlicing8(crc, data, size);
+  }
+
+  auto load = [](const unsigned char* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  };
+  auto fold = [](__m128i x, __m128i k, __m128i next) {
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+                                       _mm_clmulepi64_si128(x, k, 0x11)),
+                         next);
+  };
+
+  __m128i x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(crc)));
+  __m128i x2 = load(data + 16);
+  __m128i x3 = load(data + 32);
+  __m128i x4 = load(data + 48);
+  data += 64;
+  size -= 64;
+
+  __m128i k = _mm_set_epi64x(0x1C6E41596, 0x154442BD4);
+  while (size >= 64) {
+    x1 = fold(x1, k, load(data));
+    x2 = fold(x2, k, load(data + 16));
+    x3 = fold(x3, k, load(data + 32));
+    x4 = fold(x4, k, load(data + 48));
+    data += 64;
+    size -= 64;
+  }
+
+  k  = _mm_set_epi64x(0x0CCAA009E, 0x1751997D0);
+  x1 = fold(x1, k, x2);
+  x1 = fold(x1, k, x3);
+  x1 = fold(x1, k, x4);
+  while (size >= 16) {
+    x1 = fold(x1, k, load(data));
+    data += 16;
+    size -= 16;
+  }
+
+  // 128 bits to 64 bits:
+  const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x10), _mm_srli_si128(x1, 8));
+
+  // 64 bits to 32 bits:
+  k  = _mm_set_epi64x(0, 0x163CD6124);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 4),
+                     _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00));
+
+  // Barrett reduction:
+  k   = _mm_set_epi64x(0x1F7011641, 0x1DB710641);
+  x2  = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+  x2  = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), k, 0x00);
+  crc = static_cast<uint32_t>(_mm_extract_epi32(_mm_xor_si128(x1, x2), 1));
+
+  return UpdateSlicing8(crc, data, size);
+}
+
+bool HasPclmul()
+{
+  // PCLMULQDQ and SSE4.1 (for the extraction of the result):
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 19)) != 0;
+}
+
+#elif defined(ARCHIVE_CRC32_ARM)
+
+uint32_t UpdateArm(uint32_t crc, const unsigned char* data, std::size_t size)
+{
+  while (size >= 8) {
+    uint64_t value;
+    std::memcpy(&value, data, 8);
+    crc = __crc32d(crc, value);
+    data += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = __crc32b(crc, *data++);
+  }
+  return crc;
+}
+
+#endif
+
+using UpdateFunc = uint32_t (*)(uint32_t, const unsigned char*, std::size_t);
+
+UpdateFunc SelectUpdate()
+{
+#if defined(ARCHIVE_CRC32_PCLMUL)
+  if (HasPclmul()) {
+    return UpdatePclmul;
+  }
+#elif defined(ARCHIVE_CRC32_ARM)
+  if (IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE)) {
+    return UpdateArm;
+  }
+#endif
+  return UpdateSlicing8;
+}
+
+const UpdateFunc Update = SelectUpdate();
+
+}  // namespace
+
+void Crc32::update(const void* data, std::size_t size)
+{
+  m_Value = Update(m_Value, static_cast<const unsigned char*>(data), size);
+}
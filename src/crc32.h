@@ -0,0 +1,58 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_CRC32_H
+#define ARCHIVE_CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Incremental CRC32 (the one used by zip, 7z, rar, ...), used to verify the content
+ * of entries as they are written.
+ *
+ * The implementation is selected once at runtime: carry-less multiplication
+ * (PCLMULQDQ) on x86, the CRC32 instructions on ARMv8, and slicing-by-8 otherwise.
+ */
+class Crc32
+{
+public:
+  Crc32() : m_Value(0xFFFFFFFF) {}
+
+  /**
+   * @brief Start a new CRC, discarding the current one.
+   */
+  void reset() { m_Value = 0xFFFFFFFF; }
+
+  /**
+   * @brief Add the given data to the current CRC.
+   */
+  void update(const void* data, std::size_t size);
+
+  /**
+   * @return the CRC of the data added since the last reset().
+   */
+  uint32_t value() const { return ~m_Value; }
+
+private:
+  uint32_t m_Value;
+};
+
+#endif
@@ -0,0 +1,437 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "entryreader.h"
+#include <Unknwn.h>
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "7zip/IPassword.h"
+
+#include "extractcallback.h"
+#include "formatter.h"
+#include "unknown_impl.h"
+
+/**
+ * Output stream that collects the decoded content of an entry into chunks. Only
+ * the chunks in [first, last) are kept, and writing fails with E_ABORT as soon as
+ * the last one is complete so that 7z stops decoding.
+ */
+class EntryChunkOutStream : public ISequentialOutStream
+{
+
+  UNKNOWN_1_INTERFACE(ISequentialOutStream);
+
+public:
+  using ChunkCallback = std::function<void(UInt64, std::vector<unsigned char>)>;
+
+  EntryChunkOutStream(UInt64 first, UInt64 last, ChunkCallback callback)
+      : m_First(first), m_Last(last), m_Position(0), m_Callback(callback)
+  {}
+
+  virtual ~EntryChunkOutStream() {}
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize) override
+  {
+    auto* bytes        = static_cast<const unsigned char*>(data);
+    UInt32 remaining   = size;
+    const UInt64 start = m_First * EntryReader::CHUNK_SIZE;
+    const UInt64 end   = m_Last * EntryReader::CHUNK_SIZE;
+
+    while (remaining > 0 && m_Position < end) {
+      const UInt64 inChunk = m_Position % EntryReader::CHUNK_SIZE;
+      const UInt32 length  = static_cast<UInt32>(
+          std::min<UInt64>(remaining, EntryReader::CHUNK_SIZE - inChunk));
+
+      if (m_Position >= start) {
+        m_Current.insert(m_Current.end(), bytes, bytes + length);
+        if (m_Current.size() == EntryReader::CHUNK_SIZE) {
+          m_Callback(m_Position / EntryReader::CHUNK_SIZE, std::move(m_Current));
+          m_Current = {};
+        }
+      }
+
+      m_Position += length;
+      bytes += length;
+      remaining -= length;
+    }
+
+    if (processedSize != nullptr) {
+      *processedSize = size;
+    }
+
+    // We have everything we wanted, no need to decode the rest of the entry:
+    return m_Position >= end ? E_ABORT : S_OK;
+  }
+
+  /**
+   * Store the last incomplete chunk, if any. Must be called once the extraction
+   * is over.
+   */
+  void Finish()
+  {
+    if (!m_Current.empty()) {
+      m_Callback((m_Position - 1) / EntryReader::CHUNK_SIZE, std::move(m_Current));
+      m_Current = {};
+    }
+  }
+
+private:
+  UInt64 m_First;
+  UInt64 m_Last;
+  UInt64 m_Position;
+  std::vector<unsigned char> m_Current;
+  ChunkCallback m_Callback;
+};
+
+/**
+ * Minimal extract callback used to decode a single entry into an
+ * EntryChunkOutStream.
+ */
+class EntryExtractCallback : public IArchiveExtractCallback,
+                             public ICryptoGetTextPassword
+{
+
+  UNKNOWN_3_INTERFACE(IArchiveExtractCallback, ICryptoGetTextPassword, IProgress);
+
+public:
+  EntryExtractCallback(UInt32 index, ISequentialOutStream* stream,
+                       Archive::PasswordCallback passwordCallback,
+                       std::wstring* password)
+      : m_Index(index), m_Stream(stream), m_PasswordCallback(passwordCallback),
+        m_Password(password)
+  {}
+
+  virtual ~EntryExtractCallback() {}
+
+  // Result of the extraction of the entry, if it was reported.
+  std::optional<Int32> operationResult() const { return m_OperationResult; }
+
+  Z7_IFACE_COM7_IMP(IProgress)
+  Z7_IFACE_COM7_IMP(IArchiveExtractCallback)
+
+  // ICryptoGetTextPassword
+  STDMETHOD(CryptoGetTextPassword)(BSTR* passwordOut)
+  {
+    if (m_Password->empty() && m_PasswordCallback) {
+      *m_Password = m_PasswordCallback();
+    }
+
+    *passwordOut = ::SysAllocString(m_Password->c_str());
+    return *passwordOut != 0 ? S_OK : E_OUTOFMEMORY;
+  }
+
+private:
+  UInt32 m_Index;
+  CComPtr<ISequentialOutStream> m_Stream;
+  Archive::PasswordCallback m_PasswordCallback;
+  std::wstring* m_Password;
+  std::optional<Int32> m_OperationResult;
+};
+
+STDMETHODIMP EntryExtractCallback::SetTotal(UInt64) throw()
+{
+  return S_OK;
+}
+
+STDMETHODIMP EntryExtractCallback::SetCompleted(const UInt64*) throw()
+{
+  return S_OK;
+}
+
+STDMETHODIMP EntryExtractCallback::GetStream(UInt32 index,
+                                             ISequentialOutStream** outStream,
+                                             Int32 askExtractMode) throw()
+{
+  *outStream = nullptr;
+  if (index != m_Index || askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+    return S_OK;
+  }
+
+  CComPtr<ISequentialOutStream> stream(m_Stream);
+  *outStream = stream.Detach();
+  return S_OK;
+}
+
+STDMETHODIMP EntryExtractCallback::PrepareOperation(Int32) throw()
+{
+  return S_OK;
+}
+
+STDMETHODIMP EntryExtractCallback::SetOperationResult(Int32 operationResult) throw()
+{
+  m_OperationResult = operationResult;
+  return S_OK;
+}
+
+//////////////////////////
+// EntryReader
+
+EntryReader::EntryReader(IInArchive* archiveHandler, UInt32 index, UInt64 size,
+                         Archive::PasswordCallback passwordCallback,
+                         Archive::LogCallback logCallback, std::wstring const& password)
+    : m_ArchiveHandler(archiveHandler), m_Index(index), m_Size(size),
+      m_PasswordCallback(passwordCallback), m_LogCallback(logCallback),
+      m_Password(password), m_StreamOpened(false), m_StreamPosition(0)
+{}
+
+bool EntryReader::read(uint64_t offset, void* buffer, std::size_t size,
+                       std::size_t* bytesRead)
+{
+  if (bytesRead != nullptr) {
+    *bytesRead = 0;
+  }
+
+  if (offset >= m_Size) {
+    return true;
+  }
+
+  size       = static_cast<std::size_t>(std::min<UInt64>(size, m_Size - offset));
+  auto* dest = static_cast<unsigned char*>(buffer);
+
+  while (size > 0) {
+    Chunk const* chunk = getChunk(offset / CHUNK_SIZE);
+    if (chunk == nullptr) {
+      return false;
+    }
+
+    const std::size_t inChunk = static_cast<std::size_t>(offset % CHUNK_SIZE);
+    if (inChunk >= chunk->size()) {
+      // The entry is shorter than what the archive says:
+      break;
+    }
+
+    const std::size_t length = std::min(size, chunk->size() - inChunk);
+    std::memcpy(dest, chunk->data() + inChunk, length);
+
+    dest += length;
+    offset += length;
+    size -= length;
+    if (bytesRead != nullptr) {
+      *bytesRead += length;
+    }
+  }
+
+  return true;
+}
+
+EntryReader::Chunk const* EntryReader::getChunk(UInt64 index)
+{
+  auto it = m_ChunkMap.find(index);
+  if (it != m_ChunkMap.end()) {
+    m_Chunks.splice(m_Chunks.begin(), m_Chunks, it->second);
+    return &it->second->second;
+  }
+
+  bool loaded;
+  if (!m_StreamOpened) {
+    m_StreamOpened = true;
+    openStream();
+  }
+
+  if (m_SeekableStream) {
+    loaded = loadFromSeekableStream(index);
+  } else if (m_SequentialStream) {
+    loaded = loadFromSequentialStream(index);
+  } else {
+    loaded = loadFromExtract(index);
+  }
+
+  it = m_ChunkMap.find(index);
+  if (!loaded || it == m_ChunkMap.end()) {
+    m_LogCallback(Archive::LogLevel::Error,
+                  std::format(L"Failed to read chunk {} of entry {}.", index, m_Index));
+    return nullptr;
+  }
+
+  return &it->second->second;
+}
+
+EntryReader::Chunk const* EntryReader::insertChunk(UInt64 index, Chunk chunk)
+{
+  auto it = m_ChunkMap.find(index);
+  if (it != m_ChunkMap.end()) {
+    it->second->second = std::move(chunk);
+    m_Chunks.splice(m_Chunks.begin(), m_Chunks, it->second);
+    return &it->second->second;
+  }
+
+  if (m_Chunks.size() >= MAX_CHUNKS) {
+    m_ChunkMap.erase(m_Chunks.back().first);
+    m_Chunks.pop_back();
+  }
+
+  m_Chunks.emplace_front(index, std::move(chunk));
+  m_ChunkMap[index] = m_Chunks.begin();
+  return &m_Chunks.front().second;
+}
+
+bool EntryReader::openStream()
+{
+  m_SeekableStream.Release();
+  m_SequentialStream.Release();
+  m_StreamPosition = 0;
+
+  CComPtr<IInArchiveGetStream> getStream;
+  if (m_ArchiveHandler->QueryInterface(IID_IInArchiveGetStream, (void**)&getStream) !=
+          S_OK ||
+      !getStream) {
+    return false;
+  }
+
+  if (getStream->GetStream(m_Index, &m_SequentialStream) != S_OK ||
+      !m_SequentialStream) {
+    m_SequentialStream.Release();
+    return false;
+  }
+
+  // Not an error if this fails, we will simply read the stream sequentially:
+  m_SequentialStream->QueryInterface(IID_IInStream, (void**)&m_SeekableStream);
+
+  return true;
+}
+
+UInt64 EntryReader::chunkLength(UInt64 index) const
+{
+  const UInt64 start = index * CHUNK_SIZE;
+  return start >= m_Size ? 0 : std::min<UInt64>(CHUNK_SIZE, m_Size - start);
+}
+
+// Read as much as possible (up to size) from the given stream.
+static HRESULT ReadFully(ISequentialInStream* stream, unsigned char* data, UInt64 size,
+                         UInt64* processedSize)
+{
+  *processedSize = 0;
+  while (*processedSize < size) {
+    UInt32 processed = 0;
+    RINOK(stream->Read(data + *processedSize,
+                       static_cast<UInt32>(std::min<UInt64>(size - *processedSize,
+                                                            1u << 30)),
+                       &processed));
+    if (processed == 0) {
+      break;
+    }
+    *processedSize += processed;
+  }
+  return S_OK;
+}
+
+bool EntryReader::loadFromSeekableStream(UInt64 index)
+{
+  Chunk chunk(chunkLength(index));
+
+  UInt64 processed;
+  if (m_SeekableStream->Seek(index * CHUNK_SIZE, STREAM_SEEK_SET, nullptr) != S_OK ||
+      ReadFully(m_SeekableStream, chunk.data(), chunk.size(), &processed) != S_OK) {
+    return false;
+  }
+
+  chunk.resize(processed);
+  insertChunk(index, std::move(chunk));
+  return true;
+}
+
+bool EntryReader::loadFromSequentialStream(UInt64 index)
+{
+  // Going backward, we need to start over:
+  if (index * CHUNK_SIZE < m_StreamPosition && !openStream()) {
+    return false;
+  }
+
+  while (m_StreamPosition <= index * CHUNK_SIZE) {
+    const UInt64 current = m_StreamPosition / CHUNK_SIZE;
+
+    Chunk chunk(chunkLength(current));
+    UInt64 processed;
+    if (chunk.empty() ||
+        ReadFully(m_SequentialStream, chunk.data(), chunk.size(), &processed) !=
+            S_OK ||
+        processed == 0) {
+      return false;
+    }
+    chunk.resize(processed);
+    m_StreamPosition += processed;
+
+    // Only keep the chunks that would not be evicted before reaching the requested
+    // one anyway:
+    if (current + MAX_CHUNKS / 2 > index) {
+      insertChunk(current, std::move(chunk));
+    }
+
+    if (processed < CHUNK_SIZE) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+bool EntryReader::loadFromExtract(UInt64 index)
+{
+  // Chunks are only cached once we know that the extraction went well:
+  std::vector<std::pair<UInt64, Chunk>> chunks;
+  CComPtr<EntryChunkOutStream> stream(
+      new EntryChunkOutStream(index, index + DECODE_CHUNKS, [&chunks](auto i, auto c) {
+        chunks.emplace_back(i, std::move(c));
+      }));
+  CComPtr<EntryExtractCallback> callback(
+      new EntryExtractCallback(m_Index, stream, m_PasswordCallback, &m_Password));
+
+  // E_ABORT is expected since the stream stops the extraction once it has the
+  // chunks it needs, in which case the result of the entry is usually not reported:
+  HRESULT result = m_ArchiveHandler->Extract(&m_Index, 1, false, callback);
+  auto operationResult = callback->operationResult();
+
+  if (result != S_OK && result != E_ABORT) {
+    m_LogCallback(Archive::LogLevel::Error,
+                  std::format(L"Extract() failed with {:#x} while reading entry {}.",
+                              static_cast<unsigned long>(result), m_Index));
+    return false;
+  }
+
+  if (operationResult &&
+      *operationResult != NArchive::NExtract::NOperationResult::kOK) {
+    m_LogCallback(Archive::LogLevel::Error,
+                  std::format(L"Failed to read entry {}: {}.", m_Index,
+                              operationResultToString(*operationResult)));
+    return false;
+  }
+
+  // The last chunk of the entry is incomplete, and can only be trusted if the
+  // extraction reached the end of the entry successfully:
+  if (result == S_OK) {
+    if (!operationResult) {
+      return false;
+    }
+    stream->Finish();
+  }
+
+  for (auto& [i, chunk] : chunks) {
+    insertChunk(i, std::move(chunk));
+  }
+
+  return true;
+}
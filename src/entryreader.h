@@ -0,0 +1,108 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_ENTRYREADER_H
+#define ARCHIVE_ENTRYREADER_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "7zip/Archive/IArchive.h"
+
+#include <atlbase.h>
+
+#include "archive.h"
+
+/**
+ * Implementation of ArchiveEntryReader.
+ *
+ * The content of the entry is split in fixed-size chunks that are kept in a small
+ * LRU cache. Chunks are obtained in one of three ways, depending on what the handler
+ * supports for the entry:
+ *
+ * - if IInArchiveGetStream gives a seekable stream (stored or non-solid entries for
+ *   most formats), chunks are read directly at their offset,
+ * - if it gives a sequential stream, chunks are read forward and the stream is only
+ *   re-created when reading backward past the cached chunks,
+ * - otherwise, the entry is decoded through IInArchive::Extract and the decoding is
+ *   aborted as soon as the requested chunks have been produced.
+ */
+class EntryReader : public ArchiveEntryReader
+{
+public:
+  // Size of a cached chunk, and maximum number of chunks in the cache.
+  static constexpr std::size_t CHUNK_SIZE = 1 << 20;
+  static constexpr std::size_t MAX_CHUNKS = 32;
+
+  // Number of chunks kept from a single decoding pass when the entry has to be
+  // extracted to be read.
+  static constexpr std::size_t DECODE_CHUNKS = 8;
+
+  EntryReader(IInArchive* archiveHandler, UInt32 index, UInt64 size,
+              Archive::PasswordCallback passwordCallback,
+              Archive::LogCallback logCallback, std::wstring const& password);
+
+  virtual uint64_t getSize() const override { return m_Size; }
+  virtual bool read(uint64_t offset, void* buffer, std::size_t size,
+                    std::size_t* bytesRead) override;
+
+private:
+  using Chunk = std::vector<unsigned char>;
+
+  // Retrieve the chunk at the given index from the cache, loading it if needed.
+  // Returns nullptr on failure.
+  Chunk const* getChunk(UInt64 index);
+
+  // Insert the given chunk in the cache, evicting the least recently used one if
+  // the cache is full.
+  Chunk const* insertChunk(UInt64 index, Chunk chunk);
+
+  // Open a stream on the entry through IInArchiveGetStream, if supported.
+  bool openStream();
+
+  bool loadFromSeekableStream(UInt64 index);
+  bool loadFromSequentialStream(UInt64 index);
+  bool loadFromExtract(UInt64 index);
+
+  UInt64 chunkLength(UInt64 index) const;
+
+  CComPtr<IInArchive> m_ArchiveHandler;
+  UInt32 m_Index;
+  UInt64 m_Size;
+
+  Archive::PasswordCallback m_PasswordCallback;
+  Archive::LogCallback m_LogCallback;
+  std::wstring m_Password;
+
+  // Stream obtained from IInArchiveGetStream (if any), and the seekable interface of
+  // it (if any). m_StreamPosition is only meaningful for sequential streams.
+  bool m_StreamOpened;
+  CComPtr<ISequentialInStream> m_SequentialStream;
+  CComPtr<IInStream> m_SeekableStream;
+  UInt64 m_StreamPosition;
+
+  // The cache, most recently used chunks first.
+  std::list<std::pair<UInt64, Chunk>> m_Chunks;
+  std::unordered_map<UInt64, std::list<std::pair<UInt64, Chunk>>::iterator> m_ChunkMap;
+};
+
+#endif
@@ -20,15 +20,28 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <Unknwn.h>
 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <format>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 #include "archive.h"
 #include "extractcallback.h"
 #include "propertyvariant.h"
 
+// Maximum number of buffered files waiting to be written by the writer pool. This
+// bounds the memory used by buffered files to this times the small file threshold.
+static constexpr std::size_t MAX_PENDING_WRITES = 256;
+
+// Size and alignment of the buffers used for unbuffered I/O. The alignment must be a
+// multiple of the sector size of the output volume, otherwise regular I/O is used.
+static constexpr std::size_t DIRECT_IO_BUFFER_SIZE      = 4 << 20;
+static constexpr std::size_t DIRECT_IO_BUFFER_ALIGNMENT = 4096;
+
 std::wstring operationResultToString(Int32 operationResult)
 {
   namespace R = NArchive::NExtract::NOperationResult;
@@ -71,37 +84,89 @@ std::wstring operationResultToString(Int32 operationResult)
 
 CArchiveExtractCallback::CArchiveExtractCallback(
     Archive::ProgressCallback progressCallback,
+    Archive::ProgressStatsCallback progressStatsCallback,
     Archive::FileChangeCallback fileChangeCallback,
     Archive::ErrorCallback errorCallback, Archive::PasswordCallback passwordCallback,
     Archive::LogCallback logCallback, IInArchive* archiveHandler,
     std::wstring const& directoryPath, FileData* const* fileData, std::size_t nbFiles,
-    UInt64 totalFileSize, std::wstring* password)
-    : m_ArchiveHandler(archiveHandler), m_Total(0), m_DirectoryPath(),
-      m_Extracting(false), m_Canceled(false), m_Timers{}, m_ProcessedFileInfo{},
-      m_OutputFileStream{}, m_OutFileStreamCom{}, m_FileData(fileData),
-      m_NbFiles(nbFiles), m_TotalFileSize(totalFileSize), m_ExtractedFileSize(0),
-      m_LastCallbackFileSize(0), m_ProgressCallback(progressCallback),
+    std::vector<UInt32> const& order, UInt64 totalFileSize, std::wstring* password,
+    Archive::ExtractOptions const& options, ProgressState* progressState,
+    CancellationToken const* cancelToken,
+    std::shared_ptr<ExtractionScheduler::Job> schedulerJob, MemoryBudget* memoryBudget,
+    IOCounters* ioCounters, HashCallback hashCallback)
+    : m_ArchiveHandler(archiveHandler), m_Total(0), m_Completed(0),
+      m_CompletedBase(0), m_RemainingSize(0), m_DirectoryPath(),
+      m_Extracting(false), m_CancelToken(cancelToken), m_Timers{},
+      m_TraceEntry(ArchiveTrace::NO_ENTRY), m_TraceEntryStart{},
+      m_ProcessedFileInfo{}, m_CurrentIndex(0), m_OutputFileStream{},
+      m_OutFileStreamCom{}, m_FileData(fileData), m_NbFiles(nbFiles),
+      m_TotalFileSize(totalFileSize), m_ExtractedFileSize(0),
+      m_LastCallbackFileSize(0), m_ExtractedFiles(0),
+      m_ArchiveProgress(options.progressInterval, options.progressGranularity),
+      m_ExtractionProgress(options.progressInterval, options.progressGranularity),
+      m_ProgressState(progressState), m_ProgressCallback(progressCallback),
+      m_ProgressStatsCallback(progressStatsCallback),
       m_FileChangeCallback(fileChangeCallback), m_ErrorCallback(errorCallback),
       m_PasswordCallback(passwordCallback), m_LogCallback(logCallback),
-      m_Password(password)
+      m_HashCallback(hashCallback), m_Password(password), m_Options(options),
+      m_SchedulerJob(std::move(schedulerJob)), m_ReservedBytes(0),
+      m_MemoryBudget(memoryBudget), m_IOCounters(ioCounters)
 {
   m_DirectoryPath = IO::make_path(directoryPath);
+
+  // With the shared scheduler, the pools only track our jobs and run them on the
+  // threads of the scheduler:
+  auto makePool = [this](std::size_t nThreads, std::size_t maxPendingJobs) {
+    return m_SchedulerJob
+               ? std::make_unique<WriterPool>(m_SchedulerJob, maxPendingJobs)
+               : std::make_unique<WriterPool>(nThreads, maxPendingJobs);
+  };
+
+  if (m_Options.smallFileThreshold > 0 && m_Options.writerThreads > 0) {
+    m_WriterPool = makePool(m_Options.writerThreads, MAX_PENDING_WRITES);
+  }
+
+  if (m_Options.closeThreads > 0) {
+    m_ClosePool = makePool(m_Options.closeThreads,
+                           std::max<std::size_t>(m_Options.maxPendingCloses, 1));
+  }
+
+  // There is only one unbuffered stream at a time, so a single buffer is used:
+  if (m_Options.directIOThreshold > 0 &&
+      m_MemoryBudget->tryAcquire(DIRECT_IO_BUFFER_SIZE)) {
+    m_DirectBufferPool = std::make_unique<AlignedBufferPool>(
+        DIRECT_IO_BUFFER_SIZE, DIRECT_IO_BUFFER_ALIGNMENT);
+  }
+
+  if (m_Options.preallocateLookahead > 0) {
+    // Files are prepared in the order the entries will be extracted:
+    std::vector<Preallocator::Entry> entries;
+    for (auto i : order) {
+      auto const& filenames = m_FileData[i]->getOutputFilePaths();
+      if (filenames.empty() || m_FileData[i]->isDirectory() ||
+          isSmallFile(m_FileData[i]->getSize()) ||
+          isLargeFile(m_FileData[i]->getSize())) {
+        continue;
+      }
+
+      Preallocator::Entry entry{i, m_FileData[i]->getSize(), {}};
+      for (auto const& filename : filenames) {
+        entry.paths.push_back(m_DirectoryPath /
+                              std::filesystem::path(filename).make_preferred());
+      }
+      entries.push_back(std::move(entry));
+    }
+
+    m_Preallocator = std::make_unique<Preallocator>(
+        std::move(entries), m_Options.preallocateLookahead, m_Options.preallocate);
+  }
 }
 
 CArchiveExtractCallback::~CArchiveExtractCallback()
 {
-#ifdef INSTRUMENT_ARCHIVE
-  m_LogCallback(Archive::LogLevel::Debug, m_Timers.GetStream.toString(L"GetStream"));
-  m_LogCallback(Archive::LogLevel::Debug, m_Timers.SetOperationResult.SetMTime.toString(
-                                              L"SetOperationResult.SetMTime"));
-  m_LogCallback(Archive::LogLevel::Debug, m_Timers.SetOperationResult.Close.toString(
-                                              L"SetOperationResult.Close"));
-  m_LogCallback(Archive::LogLevel::Debug, m_Timers.SetOperationResult.Release.toString(
-                                              L"SetOperationResult.Release"));
-  m_LogCallback(Archive::LogLevel::Debug,
-                m_Timers.SetOperationResult.SetFileAttributesW.toString(
-                    L"SetOperationResult.SetFileAttributesW"));
-#endif
+  if (m_DirectBufferPool) {
+    m_MemoryBudget->release(DIRECT_IO_BUFFER_SIZE);
+  }
 }
 
 STDMETHODIMP CArchiveExtractCallback::SetTotal(UInt64 size) throw()
@@ -111,11 +176,49 @@ STDMETHODIMP CArchiveExtractCallback::SetTotal(UInt64 size) throw()
 }
 
 STDMETHODIMP CArchiveExtractCallback::SetCompleted(const UInt64* completed) throw()
+{
+  m_MemoryBudget->sample();
+  if (completed != nullptr) {
+    m_Completed = *completed;
+    m_ProgressState->setBytesIn(m_CompletedBase + m_Completed);
+    reportProgress(Archive::ProgressType::ARCHIVE, m_ArchiveProgress,
+                   m_CompletedBase + m_Completed,
+                   m_CompletedBase + m_Total + m_RemainingSize);
+  }
+  return m_CancelToken->isCanceled() ? E_ABORT : S_OK;
+}
+
+void CArchiveExtractCallback::StartGroup(UInt64 remainingSize)
+{
+  m_CompletedBase += m_Completed;
+  m_Completed     = 0;
+  m_Total         = 0;
+  m_RemainingSize = remainingSize;
+}
+
+void CArchiveExtractCallback::reportProgress(Archive::ProgressType type,
+                                             ProgressMeter& meter, UInt64 completed,
+                                             UInt64 total)
+{
+  if (!m_ProgressCallback && !m_ProgressStatsCallback) {
+    return;
+  }
+
+  Archive::ProgressStats stats;
+  if (meter.update(completed, total, m_ExtractedFiles, stats)) {
+    notifyProgress(type, stats);
+  }
+}
+
+void CArchiveExtractCallback::notifyProgress(Archive::ProgressType type,
+                                             Archive::ProgressStats const& stats)
 {
   if (m_ProgressCallback) {
-    m_ProgressCallback(Archive::ProgressType::ARCHIVE, *completed, m_Total);
+    m_ProgressCallback(type, stats.completed, stats.total);
+  }
+  if (m_ProgressStatsCallback) {
+    m_ProgressStatsCallback(type, stats);
   }
-  return m_Canceled ? E_ABORT : S_OK;
 }
 
 template <typename T>
@@ -153,14 +256,17 @@ STDMETHODIMP CArchiveExtractCallback::GetStream(UInt32 index,
                                                 ISequentialOutStream** outStream,
                                                 Int32 askExtractMode) throw()
 {
-  auto guard   = m_Timers.GetStream.instrument();
+  auto guard = m_Timers.GetStream.instrument();
+  ArchiveTrace::Span span("extract", "GetStream", index);
   namespace fs = std::filesystem;
 
   *outStream = nullptr;
   m_OutFileStreamCom.Release();
 
   m_FullProcessedPaths.clear();
-  m_Extracting = false;
+  m_Extracting      = false;
+  m_TraceEntry      = ArchiveTrace::NO_ENTRY;
+  m_TraceEntryStart = {};
 
   if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
     return S_OK;
@@ -172,6 +278,13 @@ STDMETHODIMP CArchiveExtractCallback::GetStream(UInt32 index,
     return S_OK;
   }
 
+  m_ProgressState->startEntry(index);
+  m_CurrentIndex = index;
+  m_TraceEntry   = index;
+  if (ArchiveTrace::isEnabled()) {
+    m_TraceEntryStart = ArchiveTrace::clock_t::now();
+  }
+
   try {
     m_ProcessedFileInfo.AttribDefined =
         getOptionalProperty(index, kpidAttrib, &m_ProcessedFileInfo.Attrib);
@@ -198,48 +311,99 @@ STDMETHODIMP CArchiveExtractCallback::GetStream(UInt32 index,
       }
     } else {
       for (auto const& filename : filenames) {
-        auto fullProcessedPath = m_DirectoryPath / fs::path(filename).make_preferred();
-        // If the filename contains a '/' we want to make the directory
-        auto directoryPath = fullProcessedPath.parent_path();
-        if (!fs::exists(directoryPath)) {
-          // Make the containing directory
-          std::error_code ec;
-          std::filesystem::create_directories(directoryPath, ec);
-          if (ec) {
-            reportError(L"cannot created directory '{}': {}", directoryPath, ec);
-            return E_ABORT;
-          }
-          // m_DirectoryPath.mkpath(filename.left(slashPos));
-        }
-        // If the file already exists, delete it
-        if (fs::exists(fullProcessedPath)) {
-          std::error_code ec;
-          if (!fs::remove(fullProcessedPath, ec)) {
-            reportError(L"cannot delete output file '{}': {}", fullProcessedPath, ec);
-            return E_ABORT;
-          }
-        }
-        m_FullProcessedPaths.push_back(fullProcessedPath);
+        m_FullProcessedPaths.push_back(m_DirectoryPath /
+                                       fs::path(filename).make_preferred());
       }
 
-      m_OutputFileStream = new MultiOutputStream([this](UInt32 size, UInt64) {
-        m_ExtractedFileSize += size;
-        if (m_ProgressCallback) {
-          m_ProgressCallback(Archive::ProgressType::EXTRACTION, m_ExtractedFileSize,
-                             m_TotalFileSize);
-        }
-      });
+      m_OutputFileStream = new MultiOutputStream(
+          [this](UInt32 size, UInt64) {
+            m_ExtractedFileSize += size;
+            m_ProgressState->addBytesOut(size);
+            reportProgress(Archive::ProgressType::EXTRACTION, m_ExtractionProgress,
+                           m_ExtractedFileSize, m_TotalFileSize);
+          },
+          m_CancelToken, m_IOCounters);
       CComPtr<MultiOutputStream> outStreamCom(m_OutputFileStream);
+      if (m_HashCallback) {
+        m_OutputFileStream->EnableHashing();
+      }
 
-      if (!m_OutputFileStream->Open(m_FullProcessedPaths)) {
-        reportError(L"cannot open output file '{}': {}", m_FullProcessedPaths[0],
-                    ::GetLastError());
-        return E_ABORT;
+      // Not all formats store a CRC:
+      UInt32 crc;
+      m_ExpectedCRC.reset();
+      if (m_Options.verifyCRC && getOptionalProperty(index, kpidCRC, &crc)) {
+        m_ExpectedCRC = crc;
+        m_OutputFileStream->EnableCRC();
       }
 
       UInt64 fileSize;
       auto fileSizeFound = getOptionalProperty(index, kpidSize, &fileSize);
-      if (fileSizeFound && m_OutputFileStream->SetSize(fileSize) != S_OK) {
+
+      // Small files are kept in memory and written by the writer pool. For other
+      // files, use the ones prepared by the preallocator if possible, otherwise
+      // create them here:
+      std::vector<IO::FileOut> files;
+      if (fileSizeFound && isSmallFile(fileSize) &&
+          m_MemoryBudget->tryAcquire(fileSize)) {
+        // Buffered data counts against the memory budget, and the in-flight budget
+        // of the scheduler, until it is written:
+        if (m_SchedulerJob && !m_SchedulerJob->acquireBytes(fileSize)) {
+          m_MemoryBudget->release(fileSize);
+          return E_ABORT;
+        }
+        m_ReservedBytes = fileSize;
+        m_OutputFileStream->OpenBuffered(fileSize);
+      } else if (m_Preallocator && m_Preallocator->take(index, files)) {
+        m_OutputFileStream->Open(std::move(files));
+      } else {
+        for (auto const& fullProcessedPath : m_FullProcessedPaths) {
+          // If the filename contains a '/' we want to make the directory
+          auto directoryPath = fullProcessedPath.parent_path();
+          if (!fs::exists(directoryPath)) {
+            // Make the containing directory
+            std::error_code ec;
+            std::filesystem::create_directories(directoryPath, ec);
+            if (ec) {
+              reportError(L"cannot created directory '{}': {}", directoryPath, ec);
+              return E_ABORT;
+            }
+          }
+          // If the file already exists, delete it
+          if (fs::exists(fullProcessedPath)) {
+            std::error_code ec;
+            if (!fs::remove(fullProcessedPath, ec)) {
+              reportError(L"cannot delete output file '{}': {}", fullProcessedPath,
+                          ec);
+              return E_ABORT;
+            }
+          }
+        }
+
+        // Large files are written unbuffered if possible, which is decided here
+        // since it depends on the output volume:
+        const bool direct =
+            fileSizeFound && isLargeFile(fileSize) &&
+            m_OutputFileStream->OpenDirect(m_FullProcessedPaths, *m_DirectBufferPool);
+
+        if (!direct && !m_OutputFileStream->Open(m_FullProcessedPaths)) {
+          reportError(L"cannot open output file '{}': {}", m_FullProcessedPaths[0],
+                      ::GetLastError());
+          return E_ABORT;
+        }
+
+        if (fileSizeFound && m_Options.preallocate &&
+            !m_OutputFileStream->Preallocate(fileSize)) {
+          m_LogCallback(Archive::LogLevel::Warning,
+                        std::format(L"Failed to preallocate {} bytes for {}.", fileSize,
+                                    m_FullProcessedPaths[0]));
+        }
+      }
+
+      // Without preallocation, the files are still set to their final size upfront
+      // (this does nothing for unbuffered files, which are truncated by Close()):
+      if (fileSizeFound && !m_Options.preallocate &&
+          !m_OutputFileStream->IsBuffered() &&
+          m_OutputFileStream->SetSize(fileSize) != S_OK) {
         m_LogCallback(Archive::LogLevel::Error,
                       std::format(L"SetSize() failed on {}.", m_FullProcessedPaths[0]));
       }
@@ -265,7 +429,8 @@ STDMETHODIMP CArchiveExtractCallback::GetStream(UInt32 index,
 
 STDMETHODIMP CArchiveExtractCallback::PrepareOperation(Int32 askExtractMode) throw()
 {
-  if (m_Canceled) {
+  ArchiveTrace::Span span("extract", "PrepareOperation", m_TraceEntry);
+  if (m_CancelToken->isCanceled()) {
     return E_ABORT;
   }
   m_Extracting = askExtractMode == NArchive::NExtract::NAskMode::kExtract;
@@ -274,17 +439,62 @@ STDMETHODIMP CArchiveExtractCallback::PrepareOperation(Int32 askExtractMode) thr
 
 STDMETHODIMP CArchiveExtractCallback::SetOperationResult(Int32 operationResult) throw()
 {
+  ArchiveTrace::Span span("extract", "SetOperationResult", m_TraceEntry);
   if (operationResult != NArchive::NExtract::NOperationResult::kOK) {
     reportError(operationResultToString(operationResult));
   }
 
-  if (m_OutFileStreamCom) {
-    if (m_ProcessedFileInfo.MTimeDefined) {
-      auto guard = m_Timers.SetOperationResult.SetMTime.instrument();
-      m_OutputFileStream->SetMTime(&m_ProcessedFileInfo.MTime);
+  const bool buffered = m_OutFileStreamCom && m_OutputFileStream->IsBuffered();
+
+  const bool ok = operationResult == NArchive::NExtract::NOperationResult::kOK;
+  if (m_OutFileStreamCom && ok) {
+    auto crc = m_ExpectedCRC ? m_OutputFileStream->GetCRC() : std::nullopt;
+    if (crc && *crc != *m_ExpectedCRC) {
+      reportError(L"CRC mismatch for '{}': expected {:08X}, got {:08X}",
+                  m_FileData[m_CurrentIndex]->getArchiveFilePath(), *m_ExpectedCRC,
+                  *crc);
+    } else if (m_HashCallback) {
+      if (auto hash = m_OutputFileStream->GetHash()) {
+        m_HashCallback(m_CurrentIndex, *hash);
+      }
+    }
+  }
+
+  std::optional<FILETIME> mtime;
+  if (m_ProcessedFileInfo.MTimeDefined) {
+    mtime = m_ProcessedFileInfo.MTime;
+  }
+  const UInt32 attributes = getAttributes();
+
+  if (buffered) {
+    // The writer pool takes care of the time and attributes as well:
+    auto guard = m_Timers.SetOperationResult.Submit.instrument();
+    submitBufferedFile();
+  } else if (m_OutFileStreamCom && m_ClosePool) {
+    RINOK(m_OutputFileStream->Flush());
+
+    // The close pool takes care of the time and attributes as well:
+    auto guard = m_Timers.SetOperationResult.Close.instrument();
+    submitClose(mtime, attributes);
+  } else if (m_OutFileStreamCom) {
+    RINOK(m_OutputFileStream->Flush());
+
+    // Set the time and attributes through the handles we already have, and only
+    // fall back to doing it by path (later) if that fails:
+    if (mtime || attributes != 0) {
+      auto guard = m_Timers.SetOperationResult.SetMetadata.instrument();
+      if (!m_OutputFileStream->SetMetadata(mtime ? &*mtime : nullptr, attributes)) {
+        deferMetadata(mtime, attributes);
+      }
     }
+
     auto guard = m_Timers.SetOperationResult.Close.instrument();
     RINOK(m_OutputFileStream->Close())
+  } else if (m_ProcessedFileInfo.isDir && attributes != 0) {
+    // Directories do not have handles, and setting their attributes before their
+    // content is extracted could prevent creating files in them:
+    auto guard = m_Timers.SetOperationResult.DeferMetadata.instrument();
+    deferMetadata({}, attributes);
   }
 
   {
@@ -292,23 +502,15 @@ STDMETHODIMP CArchiveExtractCallback::SetOperationResult(Int32 operationResult)
     m_OutFileStreamCom.Release();
   }
 
-  auto guard = m_Timers.SetOperationResult.SetFileAttributesW.instrument();
-  if (m_Extracting && m_ProcessedFileInfo.AttribDefined) {
-    // this is moderately annoying. I can't do this on the file handle because if
-    // the file in question is a directory there isn't a file handle.
-    // Also I'd like to convert the attributes to QT attributes but I'm not sure
-    // if that's possible. Hence the conversions and strange string.
-    for (auto& path : m_FullProcessedPaths) {
-      std::wstring const fn = L"\\\\?\\" + path.native();
-      // If the attributes are POSIX-based, fix that
-      if (m_ProcessedFileInfo.Attrib & 0xF0000000)
-        m_ProcessedFileInfo.Attrib &= 0x7FFF;
-
-      // Should probably log any errors here somehow
-      ::SetFileAttributesW(fn.c_str(), m_ProcessedFileInfo.Attrib);
-    }
+  if (m_Extracting) {
+    m_ExtractedFiles++;
+    m_ProgressState->endEntry();
   }
 
+  // The whole entry, from GetStream() to now, so that the decoding is visible:
+  ArchiveTrace::record("extract", "Entry", std::exchange(m_TraceEntryStart, {}),
+                       m_TraceEntry);
+
   return S_OK;
 }
 
@@ -323,13 +525,274 @@ STDMETHODIMP CArchiveExtractCallback::CryptoGetTextPassword(BSTR* passwordOut)
   return *passwordOut != 0 ? S_OK : E_OUTOFMEMORY;
 }
 
-void CArchiveExtractCallback::SetCanceled(bool aCanceled)
+UInt64
+CArchiveExtractCallback::EstimateBufferMemory(Archive::ExtractOptions const& options,
+                                              FileData* const* fileData,
+                                              std::size_t nbFiles)
 {
-  m_Canceled = aCanceled;
+  const bool buffering = options.smallFileThreshold > 0 && options.writerThreads > 0;
+
+  UInt64 smallFiles = 0;
+  bool largeFiles   = false;
+  for (std::size_t i = 0; i < nbFiles; ++i) {
+    if (fileData[i]->getOutputFilePaths().empty() || fileData[i]->isDirectory()) {
+      continue;
+    }
+
+    const UInt64 size = fileData[i]->getSize();
+    if (buffering && size < options.smallFileThreshold) {
+      smallFiles += size;
+    } else if (options.directIOThreshold > 0 && size >= options.directIOThreshold) {
+      largeFiles = true;
+    }
+  }
+
+  // At most MAX_PENDING_WRITES files wait in the pool, plus one per writer thread:
+  const UInt64 maxBuffered =
+      static_cast<UInt64>(MAX_PENDING_WRITES + options.writerThreads) *
+      options.smallFileThreshold;
+
+  return std::min(smallFiles, maxBuffered) + (largeFiles ? DIRECT_IO_BUFFER_SIZE : 0);
+}
+
+bool CArchiveExtractCallback::isSmallFile(UInt64 size) const
+{
+  return m_WriterPool && size < m_Options.smallFileThreshold;
+}
+
+bool CArchiveExtractCallback::isLargeFile(UInt64 size) const
+{
+  return m_DirectBufferPool && size >= m_Options.directIOThreshold;
+}
+
+UInt32 CArchiveExtractCallback::getAttributes() const
+{
+  if (!m_Extracting || !m_ProcessedFileInfo.AttribDefined) {
+    return 0;
+  }
+
+  // If the attributes are POSIX-based, fix that
+  if (m_ProcessedFileInfo.Attrib & 0xF0000000) {
+    return m_ProcessedFileInfo.Attrib & 0x7FFF;
+  }
+
+  return m_ProcessedFileInfo.Attrib;
+}
+
+void CArchiveExtractCallback::deferMetadata(std::optional<FILETIME> mTime,
+                                            UInt32 attributes)
+{
+  for (auto const& path : m_FullProcessedPaths) {
+    m_DeferredMetadata.push_back({path, mTime, attributes});
+  }
+}
+
+void CArchiveExtractCallback::applyDeferredMetadata()
+{
+  // Number of entries handled by a single job of the writer pool:
+  constexpr std::size_t BATCH_SIZE = 64;
+
+  if (m_DeferredMetadata.empty()) {
+    return;
+  }
+
+  std::atomic<std::size_t> failures = 0;
+  auto apply = [&failures](auto begin, auto end) {
+    for (auto it = begin; it != end; ++it) {
+      if (!IO::SetFileMetadata(it->Path, it->MTime ? &*it->MTime : nullptr,
+                               it->Attrib)) {
+        failures++;
+      }
+    }
+  };
+
+  if (m_WriterPool) {
+    for (std::size_t i = 0; i < m_DeferredMetadata.size(); i += BATCH_SIZE) {
+      auto begin = m_DeferredMetadata.begin() + i;
+      auto end   = m_DeferredMetadata.begin() +
+                 std::min(i + BATCH_SIZE, m_DeferredMetadata.size());
+      m_WriterPool->submit([&apply, begin, end] {
+        apply(begin, end);
+      });
+    }
+    m_WriterPool->wait();
+  } else {
+    apply(m_DeferredMetadata.begin(), m_DeferredMetadata.end());
+  }
+
+  if (failures > 0) {
+    m_LogCallback(Archive::LogLevel::Warning,
+                  std::format(L"Failed to set the time or attributes of {} file(s).",
+                              failures.load()));
+  }
+
+  m_DeferredMetadata.clear();
+}
+
+void CArchiveExtractCallback::submitBufferedFile()
+{
+  std::optional<FILETIME> mtime;
+  if (m_ProcessedFileInfo.MTimeDefined) {
+    mtime = m_ProcessedFileInfo.MTime;
+  }
+  const UInt32 attributes = getAttributes();
+  const UInt64 reserved   = std::exchange(m_ReservedBytes, 0);
+
+  m_WriterPool->submit([pool = m_WriterPool.get(), paths = m_FullProcessedPaths,
+                        data = m_OutputFileStream->TakeBuffer(), mtime, attributes,
+                        job = m_SchedulerJob.get(), budget = m_MemoryBudget, reserved,
+                        counters = m_IOCounters, entry = m_TraceEntry] {
+    ArchiveTrace::Span span("io", "WriteBufferedFile", entry);
+    namespace fs = std::filesystem;
+
+    // Give back the bytes to the budgets whatever happens:
+    struct Release
+    {
+      ExtractionScheduler::Job* job;
+      MemoryBudget* budget;
+      UInt64 bytes;
+      ~Release()
+      {
+        budget->release(bytes);
+        if (job) {
+          job->releaseBytes(bytes);
+        }
+      }
+    } release{job, budget, reserved};
+
+    for (auto const& path : paths) {
+      std::error_code ec;
+      auto directoryPath = path.parent_path();
+      if (!fs::exists(directoryPath, ec)) {
+        fs::create_directories(directoryPath, ec);
+        if (ec) {
+          pool->reportError(
+              std::format(L"cannot created directory '{}': {}", directoryPath, ec));
+          return;
+        }
+      }
+
+      if (fs::exists(path, ec) && !fs::remove(path, ec)) {
+        pool->reportError(
+            std::format(L"cannot delete output file '{}': {}", path, ec));
+        return;
+      }
+
+      IO::FileOut file;
+      UInt32 processedSize;
+      if (!file.Open(path)) {
+        pool->reportError(
+            std::format(L"cannot open output file '{}': {}", path, ::GetLastError()));
+        return;
+      }
+      if (counters != nullptr) {
+        IOCounters::add(counters->fileOpens, 1);
+      }
+
+      if (!file.Write(data.data(), static_cast<UInt32>(data.size()), processedSize) ||
+          processedSize != data.size()) {
+        pool->reportError(
+            std::format(L"cannot write output file '{}': {}", path, ::GetLastError()));
+        return;
+      }
+
+      const bool metadata = mtime || attributes != 0;
+      const bool metadataSet =
+          metadata && file.SetBasicInfo(mtime ? &*mtime : nullptr, attributes);
+      file.Close();
+      if (counters != nullptr) {
+        IOCounters::add(counters->fileCloses, 1);
+      }
+
+      if (metadata && !metadataSet) {
+        IO::SetFileMetadata(path, mtime ? &*mtime : nullptr, attributes);
+      }
+    }
+  });
+}
+
+void CArchiveExtractCallback::submitClose(std::optional<FILETIME> mTime,
+                                          UInt32 attributes)
+{
+  // std::function requires copyable jobs:
+  auto files =
+      std::make_shared<std::vector<IO::FileOut>>(m_OutputFileStream->TakeFiles());
+
+  m_ClosePool->submit([pool = m_ClosePool.get(), files, paths = m_FullProcessedPaths,
+                       mTime, attributes, entry = m_TraceEntry] {
+    ArchiveTrace::Span span("io", "CloseFiles", entry);
+    const bool metadata = mTime || attributes != 0;
+    for (std::size_t i = 0; i < files->size(); ++i) {
+      auto& file = (*files)[i];
+
+      // Set the time and attributes through the handle if possible, and by path
+      // once the file is closed otherwise:
+      const bool metadataSet =
+          metadata && file.SetBasicInfo(mTime ? &*mTime : nullptr, attributes);
+
+      if (!file.Close()) {
+        pool->reportError(std::format(L"cannot close output file '{}': {}", paths[i],
+                                      ::GetLastError()));
+        continue;
+      }
+
+      if (metadata && !metadataSet) {
+        IO::SetFileMetadata(paths[i], mTime ? &*mTime : nullptr, attributes);
+      }
+    }
+  });
+}
+
+HRESULT CArchiveExtractCallback::Finish()
+{
+  // If the extraction was canceled in the middle of an entry, its output files are
+  // incomplete. Buffered entries never got to the disk, so the paths may still be
+  // those of existing files, which must be kept:
+  if (m_OutFileStreamCom && m_CancelToken->isCanceled()) {
+    const bool onDisk = !m_OutputFileStream->IsBuffered();
+    m_OutputFileStream->Close();
+    m_OutFileStreamCom.Release();
+    if (onDisk) {
+      for (auto const& path : m_FullProcessedPaths) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+      }
+    }
+  }
+
+  std::vector<std::wstring> errors;
+  for (auto* pool : {m_WriterPool.get(), m_ClosePool.get()}) {
+    if (pool) {
+      pool->wait();
+      auto poolErrors = pool->takeErrors();
+      errors.insert(errors.end(), poolErrors.begin(), poolErrors.end());
+    }
+  }
+
+  // Done after all the data is written so that nothing modifies the files
+  // afterwards:
+  applyDeferredMetadata();
+
+  // Notify the last updates if they were coalesced:
+  for (auto [type, meter] :
+       {std::pair{Archive::ProgressType::ARCHIVE, &m_ArchiveProgress},
+        std::pair{Archive::ProgressType::EXTRACTION, &m_ExtractionProgress}}) {
+    Archive::ProgressStats stats;
+    if (meter->flush(stats)) {
+      notifyProgress(type, stats);
+    }
+  }
+
+  for (auto const& error : errors) {
+    reportError(error);
+  }
+
+  return errors.empty() ? S_OK : E_FAIL;
 }
 
 void CArchiveExtractCallback::reportError(std::wstring const& message)
 {
+  m_ProgressState->addError();
   if (m_ErrorCallback) {
     m_ErrorCallback(message);
   }
@@ -25,6 +25,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <chrono>
 #include <filesystem>
 #include <format>
+#include <functional>
+#include <memory>
+#include <optional>
 
 #include "7zip/Archive/IArchive.h"
 #include "7zip/IPassword.h"
@@ -32,13 +35,26 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <atlbase.h>
 
 #include "archive.h"
+#include "cancellation.h"
 #include "formatter.h"
 #include "instrument.h"
+#include "iocounters.h"
+#include "memorybudget.h"
 #include "multioutputstream.h"
+#include "preallocator.h"
+#include "progressmeter.h"
+#include "progressstate.h"
+#include "scheduler.h"
+#include "tracer.h"
 #include "unknown_impl.h"
+#include "writerpool.h"
 
 class FileData;
 
+// Convert the result of an operation (as given to SetOperationResult) to a message,
+// empty for kOK.
+std::wstring operationResultToString(Int32 operationResult);
+
 class CArchiveExtractCallback : public IArchiveExtractCallback,
                                 public ICryptoGetTextPassword
 {
@@ -48,18 +64,58 @@ class CArchiveExtractCallback : public IArchiveExtractCallback,
   UNKNOWN_3_INTERFACE(IArchiveExtractCallback, ICryptoGetTextPassword, IProgress);
 
 public:
+  // Called with the index and the content hash of each entry successfully extracted,
+  // when ExtractOptions::computeHashes is set.
+  using HashCallback = std::function<void(UInt32, FileData::ContentHash const&)>;
+
   CArchiveExtractCallback(Archive::ProgressCallback progressCallback,
+                          Archive::ProgressStatsCallback progressStatsCallback,
                           Archive::FileChangeCallback fileChangeCallback,
                           Archive::ErrorCallback errorCallback,
                           Archive::PasswordCallback passwordCallback,
                           Archive::LogCallback logCallback, IInArchive* archiveHandler,
                           std::wstring const& directoryPath, FileData* const* fileData,
-                          std::size_t nbFiles, UInt64 totalFileSize,
-                          std::wstring* password);
+                          std::size_t nbFiles, std::vector<UInt32> const& order,
+                          UInt64 totalFileSize,
+                          std::wstring* password,
+                          Archive::ExtractOptions const& options,
+                          ProgressState* progressState,
+                          CancellationToken const* cancelToken,
+                          std::shared_ptr<ExtractionScheduler::Job> schedulerJob,
+                          MemoryBudget* memoryBudget, IOCounters* ioCounters,
+                          HashCallback hashCallback);
 
   virtual ~CArchiveExtractCallback();
 
-  void SetCanceled(bool aCanceled);
+  /**
+   * @brief Estimate the memory used by the buffers when extracting the given files
+   * with the given options.
+   */
+  static UInt64 EstimateBufferMemory(Archive::ExtractOptions const& options,
+                                     FileData* const* fileData, std::size_t nbFiles);
+
+  /**
+   * @brief Start a group of entries extracted with a separate call to Extract().
+   * Must be called before each call.
+   *
+   * 7z reports the progress of each call from 0, so the progress of the archive
+   * continues from where the previous group stopped instead.
+   *
+   * @param remainingSize Size of the entries of the groups after this one, which
+   *     is added to the total until they are reached.
+   */
+  void StartGroup(UInt64 remainingSize);
+
+  /**
+   * @brief Wait for the pending writes to complete and report their errors. Must
+   * be called once the extraction is over.
+   *
+   * If the extraction was canceled, this also removes the output files of the
+   * entry that was interrupted.
+   *
+   * @return S_OK if all the pending writes succeeded, an error otherwise.
+   */
+  HRESULT Finish();
 
   Z7_IFACE_COM7_IMP(IProgress)
   Z7_IFACE_COM7_IMP(IArchiveExtractCallback)
@@ -76,6 +132,31 @@ private:
     reportError(std::format(format, std::forward<Args>(args)...));
   }
 
+  // Whether an entry of the given size should be buffered and written by the pool.
+  bool isSmallFile(UInt64 size) const;
+
+  // Whether an entry of the given size should be written with unbuffered I/O.
+  bool isLargeFile(UInt64 size) const;
+
+  // Hand the content of the buffered stream to the writer pool.
+  void submitBufferedFile();
+
+  // Hand the files of the current stream to the close pool.
+  void submitClose(std::optional<FILETIME> mTime, UInt32 attributes);
+
+  // Attributes to set on the current entry, or 0 if there are none.
+  UInt32 getAttributes() const;
+
+  // Queue metadata that could not be set through a handle, to be set by path
+  // once all the data has been written.
+  void deferMetadata(std::optional<FILETIME> mTime, UInt32 attributes);
+  void applyDeferredMetadata();
+
+  // Notify the progress callbacks of an update, if the given meter allows it.
+  void reportProgress(Archive::ProgressType type, ProgressMeter& meter,
+                      UInt64 completed, UInt64 total);
+  void notifyProgress(Archive::ProgressType type, Archive::ProgressStats const& stats);
+
   template <typename T>
   bool getOptionalProperty(UInt32 index, int property, T* result) const;
   template <typename T>
@@ -84,24 +165,34 @@ private:
 private:
   CComPtr<IInArchive> m_ArchiveHandler;
 
+  // Total and completed bytes of the current group, as reported by 7z, bytes
+  // completed by the previous groups, and size of the next groups:
   UInt64 m_Total;
+  UInt64 m_Completed;
+  UInt64 m_CompletedBase;
+  UInt64 m_RemainingSize;
 
   std::filesystem::path m_DirectoryPath;
   bool m_Extracting;
-  std::atomic<bool> m_Canceled;
+  CancellationToken const* m_CancelToken;
 
   struct
   {
-    ArchiveTimers::Timer GetStream;
+    ArchiveTimers::Timer GetStream{L"GetStream"};
     struct
     {
-      ArchiveTimers::Timer SetMTime;
-      ArchiveTimers::Timer Close;
-      ArchiveTimers::Timer Release;
-      ArchiveTimers::Timer SetFileAttributesW;
+      ArchiveTimers::Timer SetMetadata{L"SetOperationResult.SetMetadata"};
+      ArchiveTimers::Timer Close{L"SetOperationResult.Close"};
+      ArchiveTimers::Timer Release{L"SetOperationResult.Release"};
+      ArchiveTimers::Timer DeferMetadata{L"SetOperationResult.DeferMetadata"};
+      ArchiveTimers::Timer Submit{L"SetOperationResult.Submit"};
     } SetOperationResult;
   } m_Timers;
 
+  // Entry being extracted and the time at which it started, for the trace:
+  std::int64_t m_TraceEntry;
+  ArchiveTrace::clock_t::time_point m_TraceEntryStart;
+
   struct CProcessedFileInfo
   {
     FILETIME MTime;
@@ -111,22 +202,53 @@ private:
     bool MTimeDefined;
   } m_ProcessedFileInfo;
 
+  UInt32 m_CurrentIndex;
+  std::optional<UInt32> m_ExpectedCRC;
   MultiOutputStream* m_OutputFileStream;
   CComPtr<MultiOutputStream> m_OutFileStreamCom;
 
   std::vector<std::filesystem::path> m_FullProcessedPaths;
 
+  struct DeferredMetadata
+  {
+    std::filesystem::path Path;
+    std::optional<FILETIME> MTime;
+    UInt32 Attrib;
+  };
+  std::vector<DeferredMetadata> m_DeferredMetadata;
+
+  Archive::ExtractOptions m_Options;
+  std::unique_ptr<Preallocator> m_Preallocator;
+  std::shared_ptr<ExtractionScheduler::Job> m_SchedulerJob;
+
+  // Bytes reserved from the scheduler for the current buffered entry.
+  UInt64 m_ReservedBytes;
+
+  MemoryBudget* m_MemoryBudget;
+  IOCounters* m_IOCounters;
+  std::unique_ptr<WriterPool> m_WriterPool;
+  std::unique_ptr<WriterPool> m_ClosePool;
+  std::unique_ptr<AlignedBufferPool> m_DirectBufferPool;
+
   FileData* const* m_FileData;
   std::size_t m_NbFiles;
   UInt64 m_TotalFileSize;
   UInt64 m_LastCallbackFileSize;
   UInt64 m_ExtractedFileSize;
+  UInt64 m_ExtractedFiles;
+
+  ProgressMeter m_ArchiveProgress;
+  ProgressMeter m_ExtractionProgress;
+
+  ProgressState* m_ProgressState;
 
   Archive::ProgressCallback m_ProgressCallback;
+  Archive::ProgressStatsCallback m_ProgressStatsCallback;
   Archive::FileChangeCallback m_FileChangeCallback;
   Archive::ErrorCallback m_ErrorCallback;
   Archive::PasswordCallback m_PasswordCallback;
   Archive::LogCallback m_LogCallback;
+  HashCallback m_HashCallback;
   std::wstring* m_Password;
 };
 
@@ -84,6 +84,17 @@ bool FileBase::SeekToEnd(UInt64& newPosition) noexcept
   return Seek(0, FILE_END, newPosition);
 }
 
+bool FileBase::GetSectorSize(UInt32& sectorSize) const noexcept
+{
+  FILE_STORAGE_INFO info;
+  if (!BOOLToBool(::GetFileInformationByHandleEx(m_Handle, FileStorageInfo, &info,
+                                                 sizeof(info)))) {
+    return false;
+  }
+  sectorSize = info.LogicalBytesPerSector;
+  return true;
+}
+
 bool FileBase::Create(std::filesystem::path const& path, DWORD desiredAccess,
                       DWORD shareMode, DWORD creationDisposition,
                       DWORD flagsAndAttributes) noexcept
@@ -135,6 +146,11 @@ bool FileIn::Open(std::filesystem::path const& filepath) noexcept
 {
   return OpenShared(filepath, false);
 }
+bool FileIn::OpenOverlapped(std::filesystem::path const& filepath) noexcept
+{
+  return Open(filepath, FILE_SHARE_READ, OPEN_EXISTING,
+              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED);
+}
 bool FileIn::Read(void* data, UInt32 size, UInt32& processedSize) noexcept
 {
   processedSize = 0;
@@ -165,6 +181,52 @@ bool FileIn::ReadPart(void* data, UInt32 size, UInt32& processedSize) noexcept
   return Read1(data, size, processedSize);
 }
 
+bool FileIn::ReadAt(UInt64 offset, void* data, UInt32 size,
+                    UInt32& processedSize) noexcept
+{
+  // Overlapped reads from multiple threads on the same handle each need their own
+  // event to wait on, and creating one per read would be wasteful:
+  thread_local struct Event
+  {
+    HANDLE handle = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    ~Event()
+    {
+      if (handle != nullptr) {
+        ::CloseHandle(handle);
+      }
+    }
+  } event;
+  if (event.handle == nullptr) {
+    return false;
+  }
+
+  processedSize = 0;
+  do {
+    OVERLAPPED overlapped{};
+    overlapped.Offset     = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    overlapped.hEvent     = event.handle;
+
+    // This works for both synchronous and overlapped handles, the latter returning
+    // ERROR_IO_PENDING if the read did not complete immediately:
+    DWORD processedLoc = 0;
+    if ((!::ReadFile(m_Handle, data, size > kChunkSizeMax ? kChunkSizeMax : size,
+                     nullptr, &overlapped) &&
+         ::GetLastError() != ERROR_IO_PENDING) ||
+        !::GetOverlappedResult(m_Handle, &overlapped, &processedLoc, TRUE)) {
+      // Reading at or past the end is not an error:
+      return ::GetLastError() == ERROR_HANDLE_EOF;
+    }
+    if (processedLoc == 0)
+      return true;
+    processedSize += processedLoc;
+    offset += processedLoc;
+    data = (void*)((unsigned char*)data + processedLoc);
+    size -= processedLoc;
+  } while (size > 0);
+  return true;
+}
+
 // FileOut
 
 bool FileOut::Open(std::filesystem::path const& fileName, DWORD shareMode,
@@ -179,6 +241,12 @@ bool FileOut::Open(std::filesystem::path const& fileName) noexcept
   return Open(fileName, FILE_SHARE_READ, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL);
 }
 
+bool FileOut::OpenUnbuffered(std::filesystem::path const& fileName) noexcept
+{
+  return Open(fileName, FILE_SHARE_READ, CREATE_ALWAYS,
+              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING);
+}
+
 bool FileOut::SetTime(const FILETIME* cTime, const FILETIME* aTime,
                       const FILETIME* mTime) noexcept
 {
@@ -188,6 +256,18 @@ bool FileOut::SetMTime(const FILETIME* mTime) noexcept
 {
   return SetTime(NULL, NULL, mTime);
 }
+bool FileOut::SetBasicInfo(const FILETIME* mTime, UInt32 attributes) noexcept
+{
+  // Zero values leave the corresponding information unchanged:
+  FILE_BASIC_INFO info{};
+  if (mTime != nullptr) {
+    info.LastWriteTime.LowPart  = mTime->dwLowDateTime;
+    info.LastWriteTime.HighPart = static_cast<LONG>(mTime->dwHighDateTime);
+  }
+  info.FileAttributes = attributes;
+  return BOOLToBool(
+      ::SetFileInformationByHandle(m_Handle, FileBasicInfo, &info, sizeof(info)));
+}
 bool FileOut::Write(const void* data, UInt32 size, UInt32& processedSize) noexcept
 {
   processedSize = 0;
@@ -219,6 +299,22 @@ bool FileOut::SetEndOfFile() noexcept
   return BOOLToBool(::SetEndOfFile(m_Handle));
 }
 
+bool FileOut::SetLengthKeepPosition(UInt64 length) noexcept
+{
+  FILE_END_OF_FILE_INFO info;
+  info.EndOfFile.QuadPart = static_cast<LONGLONG>(length);
+  return BOOLToBool(
+      ::SetFileInformationByHandle(m_Handle, FileEndOfFileInfo, &info, sizeof(info)));
+}
+
+bool FileOut::Preallocate(UInt64 size) noexcept
+{
+  FILE_ALLOCATION_INFO info;
+  info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+  return BOOLToBool(
+      ::SetFileInformationByHandle(m_Handle, FileAllocationInfo, &info, sizeof(info)));
+}
+
 bool FileOut::WritePart(const void* data, UInt32 size, UInt32& processedSize) noexcept
 {
   if (size > kChunkSizeMax)
@@ -229,4 +325,20 @@ bool FileOut::WritePart(const void* data, UInt32 size, UInt32& processedSize) no
   return res;
 }
 
+bool SetFileMetadata(std::filesystem::path const& path, const FILETIME* mTime,
+                     UInt32 attributes) noexcept
+{
+  bool result = true;
+  if (mTime != nullptr) {
+    FileOut file;
+    result = file.Open(path, FILE_SHARE_READ | FILE_SHARE_WRITE, OPEN_EXISTING,
+                       FILE_FLAG_BACKUP_SEMANTICS) &&
+             file.SetMTime(mTime);
+  }
+  if (attributes != 0) {
+    result = BOOLToBool(::SetFileAttributesW(path.c_str(), attributes)) && result;
+  }
+  return result;
+}
+
 }  // namespace IO
@@ -30,6 +30,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <filesystem>
 #include <string>
 
+// Convert the result of a Windows call to an HRESULT, using the last error on
+// failure, or E_FAIL if there is none.
+inline HRESULT ConvertBoolToHRESULT(bool result)
+{
+  if (result) {
+    return S_OK;
+  }
+  DWORD lastError = ::GetLastError();
+  if (lastError == 0) {
+    return E_FAIL;
+  }
+  return HRESULT_FROM_WIN32(lastError);
+}
+
 namespace IO
 {
 
@@ -115,6 +129,13 @@ public:  // Operations
   bool SeekToBegin() noexcept;
   bool SeekToEnd(UInt64& newPosition) noexcept;
 
+  // Retrieve the logical sector size of the volume containing the file, which is
+  // the alignment required for unbuffered I/O.
+  bool GetSectorSize(UInt32& sectorSize) const noexcept;
+
+  // Underlying handle, e.g. to create a file mapping. Still owned by this object.
+  HANDLE GetHandle() const noexcept { return m_Handle; }
+
   // Note: Only the static version (unlike in 7z) because I want FileInfo to hold the
   // path to the file, and the non-static version is never used (except by the static
   // version).
@@ -142,8 +163,18 @@ public:  // Operations
   bool OpenShared(std::filesystem::path const& filepath, bool shareForWrite) noexcept;
   bool Open(std::filesystem::path const& filepath) noexcept;
 
+  // Open the file for overlapped I/O, so that reads from multiple threads are not
+  // serialized by the system. The file can then only be read with ReadAt().
+  bool OpenOverlapped(std::filesystem::path const& filepath) noexcept;
+
   bool Read(void* data, UInt32 size, UInt32& processedSize) noexcept;
 
+  // Read at the given offset. For files opened with FILE_FLAG_OVERLAPPED (e.g. by
+  // OpenOverlapped()), this does not use the file pointer and can be called from
+  // multiple threads at the same time. Otherwise, the file pointer is moved and
+  // concurrent calls are serialized by the system.
+  bool ReadAt(UInt64 offset, void* data, UInt32 size, UInt32& processedSize) noexcept;
+
 protected:
   bool Read1(void* data, UInt32 size, UInt32& processedSize) noexcept;
   bool ReadPart(void* data, UInt32 size, UInt32& processedSize) noexcept;
@@ -159,18 +190,46 @@ public:  // Operations:
             DWORD creationDisposition, DWORD flagsAndAttributes) noexcept;
   bool Open(std::filesystem::path const& fileName) noexcept;
 
+  // Open the file for unbuffered writing: the data buffers, the size of every
+  // write and the position of the file must all be aligned on the sector size.
+  bool OpenUnbuffered(std::filesystem::path const& fileName) noexcept;
+
   bool SetTime(const FILETIME* cTime, const FILETIME* aTime,
                const FILETIME* mTime) noexcept;
   bool SetMTime(const FILETIME* mTime) noexcept;
+
+  // Set the modification time (if not null) and the attributes (if not 0) of the
+  // file in a single call.
+  bool SetBasicInfo(const FILETIME* mTime, UInt32 attributes) noexcept;
+
   bool Write(const void* data, UInt32 size, UInt32& processedSize) noexcept;
 
   bool SetLength(UInt64 length) noexcept;
   bool SetEndOfFile() noexcept;
 
+  // Set the length of the file without moving the file pointer.
+  bool SetLengthKeepPosition(UInt64 length) noexcept;
+
+  // Reserve disk space for the file without changing its length.
+  bool Preallocate(UInt64 size) noexcept;
+
 protected:  // Protected Operations:
   bool WritePart(const void* data, UInt32 size, UInt32& processedSize) noexcept;
 };
 
+/**
+ * @brief Set the modification time and attributes of the given file or directory
+ * by path, for when no handle is available.
+ *
+ * @param path The path to the file or directory.
+ * @param mTime The modification time to set, or null to leave it unchanged.
+ * @param attributes The attributes to set, or 0 to leave them unchanged.
+ *
+ * @return true if everything was set, false otherwise.
+ */
+bool SetFileMetadata(std::filesystem::path const& path, const FILETIME* mTime,
+                     UInt32 attributes) noexcept;
+
 /**
  * @brief Convert the given wide-string to a path object, after adding (if not already
  * present) the Windows long-path prefix.
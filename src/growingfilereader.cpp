@@ -0,0 +1,144 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "growingfilereader.h"
+
+#include <algorithm>
+#include <optional>
+#include <utility>
+
+// Reads this far ahead of the data received from the start of the file request
+// their range, closer reads simply wait for the data to arrive:
+static constexpr uint64_t RANGE_REQUEST_DISTANCE = 4 << 20;
+
+// Minimum size of the requested ranges, so that nearby reads (e.g. the rest of the
+// headers) do not each need a request:
+static constexpr uint64_t MIN_RANGE_REQUEST_SIZE = 256 << 10;
+
+GrowingFileReaderImpl::GrowingFileReaderImpl(uint64_t size,
+                                             RangeRequestCallback rangeRequestCallback,
+                                             bool sequential)
+    : m_Size(size), m_RangeRequestCallback(std::move(rangeRequestCallback)),
+      m_Sequential(sequential), m_Finished(false)
+{}
+
+bool GrowingFileReaderImpl::open(std::filesystem::path const& path)
+{
+  // The producer is still writing to the file:
+  return m_File.OpenShared(path, true);
+}
+
+bool GrowingFileReaderImpl::read(uint64_t offset, void* buffer, std::size_t size,
+                                 std::size_t* bytesRead)
+{
+  if (bytesRead != nullptr) {
+    *bytesRead = 0;
+  }
+
+  if (offset >= m_Size || size == 0) {
+    return true;
+  }
+  uint64_t end = std::min<uint64_t>(offset + size, m_Size);
+
+  std::optional<std::pair<uint64_t, uint64_t>> request;
+  {
+    std::unique_lock lock(m_Mutex);
+
+    uint64_t missing = m_Available.coveredUntil(offset);
+    if (missing < end && !m_Finished && m_RangeRequestCallback &&
+        missing > m_Available.coveredUntil(0) + RANGE_REQUEST_DISTANCE &&
+        m_Requested.coveredUntil(missing) < end) {
+      uint64_t requestEnd = std::min(std::max(end, missing + MIN_RANGE_REQUEST_SIZE),
+                                     m_Size);
+      m_Requested.insert(missing, requestEnd);
+      request = {missing, requestEnd - missing};
+    }
+  }
+
+  // The producer may mark the range available from the callback, so the lock must
+  // not be held:
+  if (request) {
+    m_RangeRequestCallback(request->first, request->second);
+  }
+
+  {
+    std::unique_lock lock(m_Mutex);
+    m_Condition.wait(lock, [&] {
+      return m_Finished || m_Available.coveredUntil(offset) >= end;
+    });
+
+    if (m_Available.coveredUntil(offset) < end) {
+      return false;
+    }
+  }
+
+  // The range is available, so it can be read without the lock:
+  auto* data = static_cast<unsigned char*>(buffer);
+  while (offset < end) {
+    UInt32 processed = 0;
+    if (!m_File.ReadAt(offset, data, static_cast<UInt32>(end - offset), processed) ||
+        processed == 0) {
+      return false;
+    }
+
+    offset += processed;
+    data += processed;
+    if (bytesRead != nullptr) {
+      *bytesRead += processed;
+    }
+  }
+
+  return true;
+}
+
+void GrowingFileReaderImpl::markAvailable(uint64_t offset, uint64_t size)
+{
+  if (size == 0) {
+    return;
+  }
+
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Available.insert(offset, offset + size);
+  }
+  m_Condition.notify_all();
+}
+
+void GrowingFileReaderImpl::finish()
+{
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Finished = true;
+  }
+  m_Condition.notify_all();
+}
+
+std::shared_ptr<GrowingFileReader>
+CreateGrowingFileReader(std::wstring const& path, uint64_t size,
+                        GrowingFileReader::RangeRequestCallback rangeRequestCallback,
+                        bool sequential)
+{
+  auto reader = std::make_shared<GrowingFileReaderImpl>(
+      size, std::move(rangeRequestCallback), sequential);
+  if (!reader->open(IO::make_path(path))) {
+    return nullptr;
+  }
+  return reader;
+}
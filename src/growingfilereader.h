@@ -0,0 +1,65 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_GROWINGFILEREADER_H
+#define ARCHIVE_GROWINGFILEREADER_H
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+
+#include "archive.h"
+#include "fileio.h"
+#include "rangeset.h"
+
+/**
+ * Implementation of GrowingFileReader, see archive.h.
+ */
+class GrowingFileReaderImpl : public GrowingFileReader
+{
+public:
+  GrowingFileReaderImpl(uint64_t size, RangeRequestCallback rangeRequestCallback,
+                        bool sequential);
+
+  bool open(std::filesystem::path const& path);
+
+  uint64_t getSize() const override { return m_Size; }
+  bool isSequential() const override { return m_Sequential; }
+
+  bool read(uint64_t offset, void* buffer, std::size_t size,
+            std::size_t* bytesRead) override;
+
+  void markAvailable(uint64_t offset, uint64_t size) override;
+  void finish() override;
+
+private:
+  IO::FileIn m_File;
+  uint64_t m_Size;
+  RangeRequestCallback m_RangeRequestCallback;
+  bool m_Sequential;
+
+  std::mutex m_Mutex;
+  std::condition_variable m_Condition;
+  RangeSet m_Available;
+  RangeSet m_Requested;
+  bool m_Finished;
+};
+
+#endif
@@ -21,17 +21,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "inputstream.h"
 #include <Unknwn.h>
 
-static inline HRESULT ConvertBoolToHRESULT(bool result)
-{
-  if (result) {
-    return S_OK;
-  }
-  DWORD lastError = ::GetLastError();
-  if (lastError == 0) {
-    return E_FAIL;
-  }
-  return HRESULT_FROM_WIN32(lastError);
-}
+#include "mappedinputstream.h"
+#include "readaheadinputstream.h"
 
 InputStream::InputStream() {}
 
@@ -68,3 +59,44 @@ STDMETHODIMP InputStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64* newPosit
   }
   return ConvertBoolToHRESULT(result);
 }
+
+// Memory-mapping files on remote or removable drives is risky (reads fail with
+// exceptions when the drive goes away) and does not save much over the network.
+static bool IsLocalFile(std::filesystem::path const& filename)
+{
+  wchar_t volume[MAX_PATH + 1];
+  if (!::GetVolumePathNameW(filename.c_str(), volume, MAX_PATH + 1)) {
+    return false;
+  }
+  const UINT type = ::GetDriveTypeW(volume);
+  return type == DRIVE_FIXED || type == DRIVE_RAMDISK;
+}
+
+CComPtr<IInStream> OpenInputStream(std::filesystem::path const& filename,
+                                   Archive::OpenOptions const& options)
+{
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(filename, ec);
+  if (options.memoryMapThreshold > 0 && !ec && size >= options.memoryMapThreshold &&
+      IsLocalFile(filename)) {
+    CComPtr<MappedInputStream> mapped(new MappedInputStream(options.accessPattern));
+    if (mapped->Open(filename)) {
+      return mapped.p;
+    }
+  }
+
+  if (options.readAheadSize > 0) {
+    CComPtr<ReadAheadInputStream> stream(
+        new ReadAheadInputStream(options.readAheadSize, options.readAheadCount));
+    if (!stream->Open(filename)) {
+      return nullptr;
+    }
+    return stream.p;
+  }
+
+  CComPtr<InputStream> file(new InputStream);
+  if (!file->Open(filename)) {
+    return nullptr;
+  }
+  return file.p;
+}
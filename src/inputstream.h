@@ -23,8 +23,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "7zip/IStream.h"
 
+#include <atlbase.h>
+
 #include <filesystem>
 
+#include "archive.h"
 #include "fileio.h"
 #include "unknown_impl.h"
 
@@ -51,4 +54,13 @@ private:
   IO::FileIn m_File;
 };
 
+/** Opens the given file with the most appropriate input stream for the given
+ * options: a memory-mapped stream for large files on local drives, a read-ahead
+ * stream for other files, or an InputStream if both are disabled
+ *
+ * @returns the stream, or null if the file could not be opened
+ */
+CComPtr<IInStream> OpenInputStream(std::filesystem::path const& filename,
+                                   Archive::OpenOptions const& options);
+
 #endif  // INPUTSTREAM_H
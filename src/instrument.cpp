@@ -0,0 +1,309 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "instrument.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace ArchiveTimers
+{
+
+std::atomic<bool> detail::enabled{false};
+
+namespace
+{
+
+  // Histograms have 8 buckets per power of two, so percentiles are within 1/8th of
+  // their actual value. Durations are in nanoseconds, and the last bucket holds
+  // everything above 2^48ns (about 3 days).
+  constexpr unsigned SUB_BUCKET_BITS = 3;
+  constexpr uint64_t SUB_BUCKET_MASK = (1 << SUB_BUCKET_BITS) - 1;
+  constexpr unsigned MAX_EXPONENT    = 47;
+
+  // One bucket per duration below 8ns, then 8 buckets per exponent:
+  constexpr std::size_t BUCKET_COUNT =
+      (MAX_EXPONENT - SUB_BUCKET_BITS + 2) << SUB_BUCKET_BITS;
+
+  // Maximum number of distinct timers, others are ignored.
+  constexpr std::size_t MAX_TIMERS = 64;
+
+  std::size_t bucketOf(uint64_t ns)
+  {
+    if (ns <= SUB_BUCKET_MASK) {
+      return static_cast<std::size_t>(ns);
+    }
+
+    unsigned exponent = static_cast<unsigned>(std::bit_width(ns)) - 1;
+    if (exponent > MAX_EXPONENT) {
+      return BUCKET_COUNT - 1;
+    }
+
+    unsigned shift = exponent - SUB_BUCKET_BITS;
+    return ((shift + 1) << SUB_BUCKET_BITS) + ((ns >> shift) & SUB_BUCKET_MASK);
+  }
+
+  // Largest duration that falls in the given bucket.
+  uint64_t bucketMax(std::size_t bucket)
+  {
+    if (bucket <= SUB_BUCKET_MASK) {
+      return bucket;
+    }
+
+    unsigned shift    = static_cast<unsigned>(bucket >> SUB_BUCKET_BITS) - 1;
+    uint64_t mantissa = (1 << SUB_BUCKET_BITS) | (bucket & SUB_BUCKET_MASK);
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+  // Only the thread owning a counter writes to it, so it does not need an atomic
+  // increment, the atomic is only there so that reports can read it.
+  void increment(std::atomic<uint64_t>& counter, uint64_t value)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  // Histogram of a timer on a single thread.
+  struct Histogram
+  {
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max{0};
+
+    void record(uint64_t ns)
+    {
+      increment(buckets[bucketOf(ns)], 1);
+      increment(calls, 1);
+      increment(total, ns);
+      if (ns > max.load(std::memory_order_relaxed)) {
+        max.store(ns, std::memory_order_relaxed);
+      }
+    }
+
+    void clear()
+    {
+      for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+      }
+      calls.store(0, std::memory_order_relaxed);
+      total.store(0, std::memory_order_relaxed);
+      max.store(0, std::memory_order_relaxed);
+    }
+  };
+
+  // Histogram of a timer merged over multiple threads.
+  struct Totals
+  {
+    std::array<uint64_t, BUCKET_COUNT> buckets{};
+    uint64_t calls = 0;
+    uint64_t total = 0;
+    uint64_t max   = 0;
+
+    void add(Histogram const& histogram)
+    {
+      for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+        buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+      }
+      calls += histogram.calls.load(std::memory_order_relaxed);
+      total += histogram.total.load(std::memory_order_relaxed);
+      max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+    }
+
+    // Upper bound of the given percentile (in [0, 1]) of the durations.
+    uint64_t percentile(double p) const
+    {
+      uint64_t rank =
+          std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * calls)));
+      uint64_t count = 0;
+      for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+        count += buckets[i];
+        if (count >= rank) {
+          return std::min(bucketMax(i), max);
+        }
+      }
+      return max;
+    }
+  };
+
+  // Histograms of a single thread, allocated the first time each timer is used on
+  // the thread.
+  struct ThreadTimers
+  {
+    std::array<std::atomic<Histogram*>, MAX_TIMERS> histograms{};
+
+    ~ThreadTimers()
+    {
+      for (auto& histogram : histograms) {
+        delete histogram.load(std::memory_order_relaxed);
+      }
+    }
+
+    Histogram& get(std::size_t id)
+    {
+      Histogram* histogram = histograms[id].load(std::memory_order_relaxed);
+      if (histogram == nullptr) {
+        histogram = new Histogram;
+        histograms[id].store(histogram, std::memory_order_release);
+      }
+      return *histogram;
+    }
+  };
+
+  class Registry
+  {
+  public:
+    static Registry& instance()
+    {
+      static Registry registry;
+      return registry;
+    }
+
+    std::size_t id(std::wstring_view name)
+    {
+      std::scoped_lock lock(m_Mutex);
+      auto it = std::find(m_Names.begin(), m_Names.end(), name);
+      if (it != m_Names.end()) {
+        return static_cast<std::size_t>(it - m_Names.begin());
+      }
+      if (m_Names.size() >= MAX_TIMERS) {
+        return MAX_TIMERS;
+      }
+
+      m_Names.emplace_back(name);
+      m_Retired.emplace_back();
+      return m_Names.size() - 1;
+    }
+
+    void attach(ThreadTimers* thread)
+    {
+      std::scoped_lock lock(m_Mutex);
+      m_Threads.push_back(thread);
+    }
+
+    // Keep the statistics of a thread that exits.
+    void detach(ThreadTimers* thread)
+    {
+      std::scoped_lock lock(m_Mutex);
+      for (std::size_t id = 0; id < m_Names.size(); ++id) {
+        if (auto* histogram = thread->histograms[id].load(std::memory_order_acquire)) {
+          m_Retired[id].add(*histogram);
+        }
+      }
+      std::erase(m_Threads, thread);
+    }
+
+    std::vector<Archive::TimerStats> report()
+    {
+      using std::chrono::nanoseconds;
+
+      std::scoped_lock lock(m_Mutex);
+      std::vector<Archive::TimerStats> stats;
+      for (std::size_t id = 0; id < m_Names.size(); ++id) {
+        Totals totals = m_Retired[id];
+        for (auto* thread : m_Threads) {
+          auto* histogram = thread->histograms[id].load(std::memory_order_acquire);
+          if (histogram != nullptr) {
+            totals.add(*histogram);
+          }
+        }
+
+        if (totals.calls > 0) {
+          stats.push_back({m_Names[id], totals.calls, nanoseconds(totals.total),
+                           nanoseconds(totals.percentile(0.5)),
+                           nanoseconds(totals.percentile(0.99)),
+                           nanoseconds(totals.max)});
+        }
+      }
+      return stats;
+    }
+
+    void reset()
+    {
+      std::scoped_lock lock(m_Mutex);
+      for (auto& retired : m_Retired) {
+        retired = {};
+      }
+      for (auto* thread : m_Threads) {
+        for (auto& histogram : thread->histograms) {
+          if (auto* h = histogram.load(std::memory_order_acquire)) {
+            h->clear();
+          }
+        }
+      }
+    }
+
+  private:
+    std::mutex m_Mutex;
+    std::vector<std::wstring> m_Names;
+    std::vector<Totals> m_Retired;
+    std::vector<ThreadTimers*> m_Threads;
+  };
+
+  // Registers the histograms of the current thread on first use.
+  struct ThreadTimersHolder
+  {
+    ThreadTimers timers;
+
+    ThreadTimersHolder() { Registry::instance().attach(&timers); }
+    ~ThreadTimersHolder() { Registry::instance().detach(&timers); }
+  };
+
+  ThreadTimers& threadTimers()
+  {
+    thread_local ThreadTimersHolder holder;
+    return holder.timers;
+  }
+
+}  // namespace
+
+void setEnabled(bool enabled)
+{
+  detail::enabled.store(enabled, std::memory_order_relaxed);
+}
+
+Timer::Timer(std::wstring_view name) : m_Id(Registry::instance().id(name)) {}
+
+void Timer::record(clock_t::duration duration) const
+{
+  if (m_Id >= MAX_TIMERS) {
+    return;
+  }
+
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  threadTimers().get(m_Id).record(static_cast<uint64_t>(std::max<int64_t>(ns, 0)));
+}
+
+std::vector<Archive::TimerStats> report()
+{
+  return Registry::instance().report();
+}
+
+void reset()
+{
+  Registry::instance().reset();
+}
+
+}  // namespace ArchiveTimers
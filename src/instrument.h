@@ -18,29 +18,47 @@ License along with this library; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+
 #ifndef ARCHIVE_INSTRUMENT_H
 #define ARCHIVE_INSTRUMENT_H
 
+#include <atomic>
 #include <chrono>
-#include <format>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "archive.h"
 
 namespace ArchiveTimers
 {
 
+namespace detail
+{
+  extern std::atomic<bool> enabled;
+}
+
 /**
- * If INSTRUMENT_ARCHIVE is not defined, we define a Timer() class that is empty and
- * does nothing, and thus should be optimized out by the compiler.
+ * @return true if timers record anything. When disabled, instrumenting a portion of
+ *     code only costs a relaxed load.
  */
-#ifdef INSTRUMENT_ARCHIVE
+inline bool isEnabled()
+{
+  return detail::enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled);
 
 /**
  * Small class that can be used to instrument portion of code using a guard.
  *
+ * Timers with the same name share their statistics, which are recorded in
+ * histograms local to each thread, and merged by report().
  */
 class Timer
 {
 public:
-  using clock_t = std::chrono::system_clock;
+  using clock_t = std::chrono::steady_clock;
 
   struct TimerGuard
   {
@@ -52,23 +70,26 @@ public:
 
     ~TimerGuard()
     {
-      m_Timer.ncalls++;
-      m_Timer.time += clock_t::now() - m_Start;
+      if (m_Timer != nullptr) {
+        m_Timer->record(clock_t::now() - m_Start);
+      }
     }
 
   private:
-    TimerGuard(Timer& timer) : m_Timer{timer}, m_Start{clock_t::now()} {}
+    TimerGuard(Timer const* timer)
+        : m_Timer{timer}, m_Start{timer ? clock_t::now() : clock_t::time_point{}}
+    {}
 
-    Timer& m_Timer;
+    Timer const* m_Timer;
     clock_t::time_point m_Start;
 
     friend class Timer;
   };
 
   /**
-   *
+   * @param name Name of the timer in the reports.
    */
-  Timer() = default;
+  explicit Timer(std::wstring_view name);
 
   /**
    * @brief Instrument a portion of code.
@@ -79,32 +100,28 @@ public:
    *
    * @return a guard to instrument the code.
    */
-  TimerGuard instrument() { return {*this}; }
+  TimerGuard instrument() const { return {isEnabled() ? this : nullptr}; }
 
-  std::wstring toString(std::wstring const& name) const
-  {
-    auto ms = [](auto&& t) {
-      return std::chrono::duration<double, std::milli>(t);
-    };
-    return std::format(
-        L"Instrument '{}': {} calls, total of {}ms, {:.3f}ms per call on average.",
-        name, ncalls, ms(time).count(), ms(time).count() / ncalls);
-  }
+  /**
+   * @brief Record a single call that took the given duration.
+   */
+  void record(clock_t::duration duration) const;
 
 private:
-  std::size_t ncalls{0};
-  clock_t::duration time{0};
+  std::size_t m_Id;
 };
 
-#else
-
-struct Timer
-{
-  // This is the only method needed:
-  Timer& instrument() { return *this; }
-};
+/**
+ * @return the statistics of all the timers that recorded at least one call since the
+ *     last reset, over all the threads.
+ */
+std::vector<Archive::TimerStats> report();
 
-#endif
+/**
+ * @brief Clear the statistics of all the timers. Calls recorded at the same time may
+ * be lost.
+ */
+void reset();
 
 }  // namespace ArchiveTimers
 
@@ -0,0 +1,87 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_IOCOUNTERS_H
+#define ARCHIVE_IOCOUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+
+#include "archive.h"
+
+/**
+ * Counters of the I/O performed on an archive, updated by its input streams (see
+ * CountingInputStream) and by the output streams of its extractions, possibly from
+ * multiple threads.
+ *
+ * The counters are relaxed atomics, so they are cheap enough to be always enabled,
+ * but a snapshot taken while streams are in use is not necessarily consistent.
+ */
+class IOCounters
+{
+public:
+  using Counter = std::atomic<uint64_t>;
+
+  Counter bytesRead{0};
+  Counter readCalls{0};
+  Counter seeks{0};
+  Counter bytesReread{0};
+
+  Counter bytesWritten{0};
+  Counter writeCalls{0};
+  Counter fileOpens{0};
+  Counter fileCloses{0};
+  Counter setSizeCalls{0};
+
+  static void add(Counter& counter, uint64_t value)
+  {
+    counter.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void reset()
+  {
+    for (auto* counter : {&bytesRead, &readCalls, &seeks, &bytesReread, &bytesWritten,
+                          &writeCalls, &fileOpens, &fileCloses, &setSizeCalls}) {
+      counter->store(0, std::memory_order_relaxed);
+    }
+  }
+
+  Archive::IOStats snapshot() const
+  {
+    auto load = [](Counter const& counter) {
+      return counter.load(std::memory_order_relaxed);
+    };
+
+    Archive::IOStats stats;
+    stats.bytesRead    = load(bytesRead);
+    stats.readCalls    = load(readCalls);
+    stats.seeks        = load(seeks);
+    stats.bytesReread  = load(bytesReread);
+    stats.bytesWritten = load(bytesWritten);
+    stats.writeCalls   = load(writeCalls);
+    stats.fileOpens    = load(fileOpens);
+    stats.fileCloses   = load(fileCloses);
+    stats.setSizeCalls = load(setSizeCalls);
+    return stats;
+  }
+};
+
+#endif
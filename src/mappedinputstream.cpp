@@ -0,0 +1,216 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "mappedinputstream.h"
+#include <Unknwn.h>
+
+#include <algorithm>
+#include <cstring>
+
+// Size of the mapped window. Most archives fit in a single window on 64-bit.
+static constexpr UInt64 WINDOW_SIZE = sizeof(void*) < 8 ? (64 << 20) : (1ull << 30);
+
+// Amount of data read ahead of sequential reads.
+static constexpr UInt64 READ_AHEAD_SIZE = 8 << 20;
+
+static UInt64 AllocationGranularity()
+{
+  static const UInt64 granularity = [] {
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    return static_cast<UInt64>(info.dwAllocationGranularity);
+  }();
+  return granularity;
+}
+
+// Reading a mapped page can fail (e.g., if the volume is removed), which raises an
+// exception instead of returning an error, so we turn it back into an error:
+static bool CopyFromView(void* data, const void* view, std::size_t size) noexcept
+{
+  __try {
+    std::memcpy(data, view, size);
+    return true;
+  } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR
+                  ? EXCEPTION_EXECUTE_HANDLER
+                  : EXCEPTION_CONTINUE_SEARCH) {
+    return false;
+  }
+}
+
+MappedInputStream::MappedInputStream(Archive::AccessPattern accessPattern)
+    : m_AccessPattern(accessPattern), m_Mapping(nullptr), m_Size(0), m_Position(0),
+      m_View(nullptr), m_ViewOffset(0), m_ViewSize(0), m_LastReadEnd(0),
+      m_ReadAheadEnd(0)
+{}
+
+MappedInputStream::~MappedInputStream()
+{
+  if (m_View != nullptr) {
+    ::UnmapViewOfFile(m_View);
+  }
+  if (m_Mapping != nullptr) {
+    ::CloseHandle(m_Mapping);
+  }
+}
+
+bool MappedInputStream::Open(std::filesystem::path const& filename)
+{
+  // The hints also apply to the cache manager, which fills the mapped pages:
+  DWORD flags = FILE_ATTRIBUTE_NORMAL;
+  if (m_AccessPattern == Archive::AccessPattern::SEQUENTIAL) {
+    flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+  } else if (m_AccessPattern == Archive::AccessPattern::RANDOM) {
+    flags |= FILE_FLAG_RANDOM_ACCESS;
+  }
+
+  if (!m_File.Open(filename, FILE_SHARE_READ, OPEN_EXISTING, flags) ||
+      !m_File.GetLength(m_Size)) {
+    return false;
+  }
+
+  // Empty files cannot be mapped:
+  if (m_Size == 0) {
+    return false;
+  }
+
+  m_Mapping =
+      ::CreateFileMappingW(m_File.GetHandle(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+  return m_Mapping != nullptr && MapWindow(0);
+}
+
+bool MappedInputStream::MapWindow(UInt64 position)
+{
+  if (m_View != nullptr) {
+    ::UnmapViewOfFile(m_View);
+    m_View     = nullptr;
+    m_ViewSize = 0;
+  }
+
+  const UInt64 offset = position / AllocationGranularity() * AllocationGranularity();
+  const UInt64 size   = std::min(WINDOW_SIZE, m_Size - offset);
+
+  m_View = static_cast<const unsigned char*>(
+      ::MapViewOfFile(m_Mapping, FILE_MAP_READ, static_cast<DWORD>(offset >> 32),
+                      static_cast<DWORD>(offset), static_cast<SIZE_T>(size)));
+  if (m_View == nullptr) {
+    return false;
+  }
+
+  m_ViewOffset   = offset;
+  m_ViewSize     = static_cast<std::size_t>(size);
+  m_ReadAheadEnd = offset;
+  return true;
+}
+
+void MappedInputStream::ReadAhead()
+{
+  const UInt64 viewEnd = m_ViewOffset + m_ViewSize;
+  const UInt64 start   = std::max(m_Position, m_ReadAheadEnd);
+
+  // Only issue a new request once half of the previous one has been consumed:
+  if (m_ReadAheadEnd >= m_Position + READ_AHEAD_SIZE / 2 || start >= viewEnd) {
+    return;
+  }
+
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = const_cast<unsigned char*>(m_View + (start - m_ViewOffset));
+  range.NumberOfBytes =
+      static_cast<SIZE_T>(std::min(m_Position + READ_AHEAD_SIZE, viewEnd) - start);
+
+  // This is only a hint, so failing is not an issue:
+  ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+  m_ReadAheadEnd = start + range.NumberOfBytes;
+}
+
+STDMETHODIMP MappedInputStream::Read(void* data, UInt32 size, UInt32* processedSize)
+{
+  if (processedSize != nullptr) {
+    *processedSize = 0;
+  }
+
+  if (m_Position >= m_Size) {
+    return S_OK;
+  }
+  size = static_cast<UInt32>(std::min<UInt64>(size, m_Size - m_Position));
+
+  const bool sequential =
+      m_AccessPattern == Archive::AccessPattern::SEQUENTIAL ||
+      (m_AccessPattern == Archive::AccessPattern::AUTO && m_Position == m_LastReadEnd);
+
+  auto* bytes = static_cast<unsigned char*>(data);
+  while (size > 0) {
+    if (m_Position < m_ViewOffset || m_Position >= m_ViewOffset + m_ViewSize) {
+      if (!MapWindow(m_Position)) {
+        return ConvertBoolToHRESULT(false);
+      }
+    }
+
+    if (sequential) {
+      ReadAhead();
+    }
+
+    const UInt32 length = static_cast<UInt32>(
+        std::min<UInt64>(size, m_ViewOffset + m_ViewSize - m_Position));
+    if (!CopyFromView(bytes, m_View + (m_Position - m_ViewOffset), length)) {
+      return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+    }
+
+    bytes += length;
+    size -= length;
+    m_Position += length;
+    if (processedSize != nullptr) {
+      *processedSize += length;
+    }
+  }
+
+  m_LastReadEnd = m_Position;
+  return S_OK;
+}
+
+STDMETHODIMP MappedInputStream::Seek(Int64 offset, UInt32 seekOrigin,
+                                     UInt64* newPosition)
+{
+  Int64 base;
+  switch (seekOrigin) {
+  case STREAM_SEEK_SET:
+    base = 0;
+    break;
+  case STREAM_SEEK_CUR:
+    base = static_cast<Int64>(m_Position);
+    break;
+  case STREAM_SEEK_END:
+    base = static_cast<Int64>(m_Size);
+    break;
+  default:
+    return STG_E_INVALIDFUNCTION;
+  }
+
+  if (base + offset < 0) {
+    return HRESULT_FROM_WIN32(ERROR_NEGATIVE_SEEK);
+  }
+
+  // Mapping the new window is left to the next read, since handlers often seek
+  // to the end to retrieve the size:
+  m_Position = static_cast<UInt64>(base + offset);
+  if (newPosition) {
+    *newPosition = m_Position;
+  }
+  return S_OK;
+}
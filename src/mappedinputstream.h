@@ -0,0 +1,87 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_MAPPEDINPUTSTREAM_H
+#define ARCHIVE_MAPPEDINPUTSTREAM_H
+
+#include "7zip/IStream.h"
+
+#include <filesystem>
+
+#include "archive.h"
+#include "fileio.h"
+#include "unknown_impl.h"
+
+/** This class implements an input stream over a memory mapping of an archive
+ *
+ * Reads are plain copies from the mapping, and seeks only update the position, so
+ * formats that do many small reads at random offsets are much cheaper to open
+ * than with InputStream.
+ *
+ * Only a window of the file is mapped at a time, so that large archives do not
+ * exhaust the address space of 32-bit processes, and the pages of the previous
+ * windows are released as the window moves.
+ */
+class MappedInputStream : public IInStream
+{
+
+  UNKNOWN_1_INTERFACE(IInStream);
+
+public:
+  MappedInputStream(Archive::AccessPattern accessPattern);
+
+  virtual ~MappedInputStream();
+
+  /** Opens and maps the given file
+   *
+   * @returns true if all went OK, false if the file could not be opened or mapped
+   *   (e.g., because it is empty)
+   */
+  bool Open(std::filesystem::path const& filename);
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+private:
+  // Map the window containing the given position.
+  bool MapWindow(UInt64 position);
+
+  // Ask the system to read ahead of the current position, within the window.
+  void ReadAhead();
+
+  Archive::AccessPattern m_AccessPattern;
+
+  IO::FileIn m_File;
+  HANDLE m_Mapping;
+  UInt64 m_Size;
+  UInt64 m_Position;
+
+  // Current window, offset of the window in the file, and size of the window.
+  const unsigned char* m_View;
+  UInt64 m_ViewOffset;
+  std::size_t m_ViewSize;
+
+  // End of the last read, to detect sequential reads, and end of the range already
+  // read ahead.
+  UInt64 m_LastReadEnd;
+  UInt64 m_ReadAheadEnd;
+};
+
+#endif
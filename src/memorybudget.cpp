@@ -0,0 +1,193 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "memorybudget.h"
+
+#include <Windows.h>
+
+#include <Psapi.h>
+
+#include <algorithm>
+#include <cwctype>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Parse a size as displayed by 7z: either a power of 2 (e.g., "24"), or a number of
+// bytes with a suffix (e.g., "1536m", "64k").
+UInt64 parseSize(std::wstring_view value)
+{
+  UInt64 number = 0;
+  std::size_t i = 0;
+  for (; i < value.size() && std::iswdigit(value[i]); ++i) {
+    number = number * 10 + (value[i] - L'0');
+  }
+
+  if (i == 0) {
+    return 0;
+  }
+
+  if (i == value.size()) {
+    return number < 64 ? UInt64(1) << number : number;
+  }
+
+  switch (std::towlower(value[i])) {
+  case L'b':
+    return number;
+  case L'k':
+    return number << 10;
+  case L'm':
+    return number << 20;
+  case L'g':
+    return number << 30;
+  default:
+    return 0;
+  }
+}
+
+std::vector<std::wstring_view> split(std::wstring_view value, wchar_t separator)
+{
+  std::vector<std::wstring_view> parts;
+  std::size_t start = 0;
+  while (start <= value.size()) {
+    auto end = value.find(separator, start);
+    if (end == std::wstring_view::npos) {
+      end = value.size();
+    }
+    if (end > start) {
+      parts.push_back(value.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return parts;
+}
+
+bool iequals(std::wstring_view lhs, std::wstring_view rhs)
+{
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                    [](wchar_t a, wchar_t b) {
+                      return std::towlower(a) == std::towlower(b);
+                    });
+}
+
+}  // namespace
+
+UInt64 EstimateDecoderMemory(std::wstring_view method)
+{
+  // Memory used by the decoders besides their dictionary, and by the ones that do
+  // not have a dictionary (BZip2 uses less than 4MB per thread):
+  constexpr UInt64 BASE_MEMORY = 4 << 20;
+
+  UInt64 total = 0;
+  for (auto coder : split(method, L' ')) {
+    auto parts = split(coder, L':');
+    if (parts.empty()) {
+      continue;
+    }
+
+    UInt64 memory = BASE_MEMORY;
+    if (iequals(parts[0], L"LZMA") || iequals(parts[0], L"LZMA2")) {
+      if (parts.size() > 1) {
+        memory += parseSize(parts[1]);
+      }
+    } else if (iequals(parts[0], L"PPMD")) {
+      for (std::size_t i = 1; i < parts.size(); ++i) {
+        if (parts[i].size() > 3 && iequals(parts[i].substr(0, 3), L"mem")) {
+          memory += parseSize(parts[i].substr(3));
+        }
+      }
+    }
+
+    // Coders of a chain are all used at the same time:
+    total += memory;
+  }
+
+  return total;
+}
+
+MemoryBudget::MemoryBudget(UInt64 limit)
+    : m_Limit(limit), m_Current(0), m_Peak(0), m_ProcessBaseline(processMemory()),
+      m_ProcessPeak(0), m_LastSample{}
+{}
+
+bool MemoryBudget::tryAcquire(UInt64 bytes)
+{
+  UInt64 current = m_Current.load(std::memory_order_relaxed);
+  do {
+    if (m_Limit > 0 && current + bytes > m_Limit) {
+      return false;
+    }
+  } while (!m_Current.compare_exchange_weak(current, current + bytes,
+                                            std::memory_order_relaxed));
+
+  UInt64 peak = m_Peak.load(std::memory_order_relaxed);
+  while (current + bytes > peak &&
+         !m_Peak.compare_exchange_weak(peak, current + bytes,
+                                       std::memory_order_relaxed)) {
+  }
+
+  return true;
+}
+
+void MemoryBudget::release(UInt64 bytes)
+{
+  m_Current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void MemoryBudget::sample()
+{
+  {
+    std::scoped_lock lock(m_SampleMutex);
+    const auto now = std::chrono::steady_clock::now();
+    if (now - m_LastSample < SAMPLE_INTERVAL) {
+      return;
+    }
+    m_LastSample = now;
+  }
+
+  const UInt64 memory = processMemory();
+  if (memory <= m_ProcessBaseline) {
+    return;
+  }
+
+  UInt64 peak = m_ProcessPeak.load(std::memory_order_relaxed);
+  while (memory - m_ProcessBaseline > peak &&
+         !m_ProcessPeak.compare_exchange_weak(peak, memory - m_ProcessBaseline,
+                                              std::memory_order_relaxed)) {
+  }
+}
+
+UInt64 MemoryBudget::processPeak() const
+{
+  return m_ProcessPeak.load(std::memory_order_relaxed);
+}
+
+UInt64 MemoryBudget::processMemory()
+{
+  PROCESS_MEMORY_COUNTERS_EX counters{};
+  if (!::GetProcessMemoryInfo(::GetCurrentProcess(),
+                              reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+                              sizeof(counters))) {
+    return 0;
+  }
+  return counters.PrivateUsage;
+}
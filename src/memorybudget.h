@@ -0,0 +1,90 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_MEMORYBUDGET_H
+#define ARCHIVE_MEMORYBUDGET_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string_view>
+
+#include "7zip/Archive/IArchive.h"
+
+/**
+ * @brief Estimate the memory needed to decode data compressed with the given method
+ * chain, as reported by kpidMethod (e.g., "LZMA2:24 BCJ", "PPMD:o6:mem24").
+ *
+ * Only the dictionary (or model) sizes are taken into account, other allocations of
+ * the decoders are small in comparison.
+ *
+ * @return the estimated size in bytes, or 0 if the method is unknown.
+ */
+UInt64 EstimateDecoderMemory(std::wstring_view method);
+
+/**
+ * Memory used by the buffers of an extraction, bounded by a limit.
+ *
+ * Buffers are reserved with tryAcquire() before being allocated, and released once
+ * freed, from any thread. The budget also samples the private memory of the process,
+ * which includes the memory used by the decoders that we cannot track directly.
+ */
+class MemoryBudget
+{
+public:
+  // Minimum interval between two samples of the process memory.
+  static constexpr std::chrono::milliseconds SAMPLE_INTERVAL{50};
+
+  // A limit of 0 means no limit.
+  explicit MemoryBudget(UInt64 limit);
+
+  /**
+   * @return true if the bytes were reserved, false if that would exceed the limit.
+   */
+  bool tryAcquire(UInt64 bytes);
+  void release(UInt64 bytes);
+
+  /**
+   * @brief Sample the private memory of the process, unless it was sampled recently.
+   */
+  void sample();
+
+  // Peak of the reserved bytes.
+  UInt64 peak() const { return m_Peak.load(std::memory_order_relaxed); }
+
+  // Peak increase of the private memory of the process since the creation of the
+  // budget.
+  UInt64 processPeak() const;
+
+private:
+  static UInt64 processMemory();
+
+  UInt64 m_Limit;
+  std::atomic<UInt64> m_Current;
+  std::atomic<UInt64> m_Peak;
+
+  UInt64 m_ProcessBaseline;
+  std::atomic<UInt64> m_ProcessPeak;
+
+  std::mutex m_SampleMutex;
+  std::chrono::steady_clock::time_point m_LastSample;
+};
+
+#endif
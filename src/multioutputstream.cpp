@@ -24,51 +24,284 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <fcntl.h>
 #include <io.h>
 
-static inline HRESULT ConvertBoolToHRESULT(bool result)
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+//////////////////////////
+// MultiOutputStream
+
+MultiOutputStream::MultiOutputStream(WriteCallback callback,
+                                     CancellationToken const* cancelToken,
+                                     IOCounters* ioCounters)
+    : m_WriteCallback(callback), m_CancelToken(cancelToken), m_IOCounters(ioCounters),
+      m_ProcessedSize(0), m_Buffered(false), m_Position(0), m_DirectPool(nullptr),
+      m_DirectBufferSize(0), m_Sequential(true), m_RequestedSize(0)
+{}
+
+MultiOutputStream::~MultiOutputStream()
 {
-  if (result) {
-    return S_OK;
+  if (m_DirectPool) {
+    m_DirectPool->release(std::move(m_DirectBuffer));
   }
-  DWORD lastError = ::GetLastError();
-  if (lastError == 0) {
-    return E_FAIL;
+}
+
+void MultiOutputStream::EnableHashing()
+{
+  if (!m_Hasher) {
+    m_Hasher = std::make_unique<ContentHasher>();
   }
-  return HRESULT_FROM_WIN32(lastError);
 }
 
-//////////////////////////
-// MultiOutputStream
+void MultiOutputStream::ResetHash()
+{
+  m_Sequential    = true;
+  m_RequestedSize = 0;
+  if (m_Hasher) {
+    m_Hasher->reset();
+  }
+  if (m_CRC) {
+    m_CRC->reset();
+  }
+}
 
-MultiOutputStream::MultiOutputStream(WriteCallback callback) : m_WriteCallback(callback)
-{}
+bool MultiOutputStream::IsSequential() const
+{
+  // If the size was extended past the written data, the end of the files was not
+  // hashed:
+  return m_Sequential && m_RequestedSize <= m_ProcessedSize;
+}
 
-MultiOutputStream::~MultiOutputStream() {}
+std::optional<FileData::ContentHash> MultiOutputStream::GetHash() const
+{
+  if (!m_Hasher || !IsSequential()) {
+    return {};
+  }
+  return m_Hasher->digest();
+}
+
+void MultiOutputStream::EnableCRC()
+{
+  m_CRC.emplace();
+}
+
+std::optional<UInt32> MultiOutputStream::GetCRC() const
+{
+  if (!m_CRC || !IsSequential()) {
+    return {};
+  }
+  return m_CRC->value();
+}
+
+HRESULT MultiOutputStream::Flush()
+{
+  if (!m_DirectPool) {
+    return S_OK;
+  }
+
+  HRESULT result = S_OK;
+
+  // Pad the last write to the alignment and truncate the files to their actual
+  // size afterwards:
+  if (m_DirectBufferSize > 0) {
+    const std::size_t alignment = m_DirectPool->alignment();
+    const std::size_t padded =
+        (m_DirectBufferSize + alignment - 1) / alignment * alignment;
+    std::memset(m_DirectBuffer.get() + m_DirectBufferSize, 0,
+                padded - m_DirectBufferSize);
+    result = FlushDirect(padded);
+  }
+
+  for (auto& file : m_Files) {
+    if (!file.SetLength(m_ProcessedSize) && result == S_OK) {
+      result = ConvertBoolToHRESULT(false);
+    }
+  }
+
+  m_DirectPool->release(std::move(m_DirectBuffer));
+  m_DirectPool = nullptr;
+
+  return result;
+}
+
+void MultiOutputStream::Count(IOCounters::Counter IOCounters::*counter, UInt64 value)
+{
+  if (m_IOCounters != nullptr) {
+    IOCounters::add(m_IOCounters->*counter, value);
+  }
+}
 
 HRESULT MultiOutputStream::Close()
 {
+  ArchiveTrace::Span span("io", "Close");
+  HRESULT result = Flush();
+
   for (auto& file : m_Files) {
     file.Close();
   }
-  return S_OK;
+  Count(&IOCounters::fileCloses, m_Files.size());
+  return result;
 }
 
 bool MultiOutputStream::Open(std::vector<std::filesystem::path> const& filepaths)
 {
   m_ProcessedSize = 0;
+  m_Buffered      = false;
   bool ok         = true;
   m_Files.clear();
+  ResetHash();
   for (auto& path : filepaths) {
     m_Files.emplace_back();
     if (!m_Files.back().Open(path.native())) {
       ok = false;
     }
   }
+  Count(&IOCounters::fileOpens, m_Files.size());
   return ok;
 }
 
+void MultiOutputStream::Open(std::vector<IO::FileOut> files)
+{
+  m_ProcessedSize = 0;
+  m_Buffered      = false;
+  m_Files         = std::move(files);
+  ResetHash();
+  Count(&IOCounters::fileOpens, m_Files.size());
+}
+
+void MultiOutputStream::OpenBuffered(UInt64 expectedSize)
+{
+  m_ProcessedSize = 0;
+  m_Buffered      = true;
+  m_Position      = 0;
+  m_Files.clear();
+  m_Buffer.clear();
+  m_Buffer.reserve(expectedSize);
+  ResetHash();
+}
+
+bool MultiOutputStream::OpenDirect(std::vector<std::filesystem::path> const& filepaths,
+                                   AlignedBufferPool& bufferPool)
+{
+  m_ProcessedSize = 0;
+  m_Buffered      = false;
+  m_Files.clear();
+  ResetHash();
+
+  for (auto& path : filepaths) {
+    m_Files.emplace_back();
+
+    UInt32 sectorSize;
+    if (!m_Files.back().OpenUnbuffered(path.native()) ||
+        !m_Files.back().GetSectorSize(sectorSize) ||
+        bufferPool.alignment() % sectorSize != 0) {
+      m_Files.clear();
+      return false;
+    }
+  }
+
+  m_DirectPool       = &bufferPool;
+  m_DirectBuffer     = bufferPool.acquire();
+  m_DirectBufferSize = 0;
+  Count(&IOCounters::fileOpens, m_Files.size());
+  return true;
+}
+
+HRESULT MultiOutputStream::FlushDirect(std::size_t size)
+{
+  for (auto& file : m_Files) {
+    UInt32 realProcessedSize;
+    if (!file.Write(m_DirectBuffer.get(), static_cast<UInt32>(size),
+                    realProcessedSize) ||
+        realProcessedSize != size) {
+      return ConvertBoolToHRESULT(false);
+    }
+  }
+  m_DirectBufferSize = 0;
+  return S_OK;
+}
+
+std::vector<unsigned char> MultiOutputStream::TakeBuffer()
+{
+  m_Position = 0;
+  return std::exchange(m_Buffer, {});
+}
+
+std::vector<IO::FileOut> MultiOutputStream::TakeFiles()
+{
+  // The files are closed by the caller:
+  Count(&IOCounters::fileCloses, m_Files.size());
+  return std::exchange(m_Files, {});
+}
+
 STDMETHODIMP MultiOutputStream::Write(const void* data, UInt32 size,
                                       UInt32* processedSize)
 {
+  if (m_CancelToken != nullptr && m_CancelToken->isCanceled()) {
+    return E_ABORT;
+  }
+
+  ArchiveTrace::Span span("io", "Write");
+
+  // The data is hot in the cache here, so hashing it now is much cheaper than
+  // reading the files back later. A failed write fails the entry, so we do not care
+  // about hashing data that is not written:
+  if (m_Hasher) {
+    m_Hasher->update(data, size);
+  }
+  if (m_CRC) {
+    m_CRC->update(data, size);
+  }
+
+  Count(&IOCounters::writeCalls, 1);
+  Count(&IOCounters::bytesWritten, size);
+
+  if (m_Buffered) {
+    if (m_Position + size > m_Buffer.size()) {
+      m_Buffer.resize(m_Position + size);
+    }
+    std::memcpy(m_Buffer.data() + m_Position, data, size);
+    m_Position += size;
+    m_ProcessedSize += size;
+    if (m_WriteCallback) {
+      m_WriteCallback(size, m_ProcessedSize);
+    }
+    if (processedSize != nullptr) {
+      *processedSize = size;
+    }
+    return S_OK;
+  }
+
+  if (m_DirectPool) {
+    auto* bytes      = static_cast<const unsigned char*>(data);
+    UInt32 remaining = size;
+    while (remaining > 0) {
+      const std::size_t length = std::min<std::size_t>(
+          remaining, m_DirectPool->bufferSize() - m_DirectBufferSize);
+      std::memcpy(m_DirectBuffer.get() + m_DirectBufferSize, bytes, length);
+      m_DirectBufferSize += length;
+      bytes += length;
+      remaining -= static_cast<UInt32>(length);
+
+      if (m_DirectBufferSize == m_DirectPool->bufferSize()) {
+        // Writes can be large here, so check again between buffers:
+        if (m_CancelToken != nullptr && m_CancelToken->isCanceled()) {
+          return E_ABORT;
+        }
+        RINOK(FlushDirect(m_DirectBufferSize));
+      }
+    }
+
+    m_ProcessedSize += size;
+    if (m_WriteCallback) {
+      m_WriteCallback(size, m_ProcessedSize);
+    }
+    if (processedSize != nullptr) {
+      *processedSize = size;
+    }
+    return S_OK;
+  }
+
   bool update_processed(true);
   for (auto& file : m_Files) {
     UInt32 realProcessedSize;
@@ -95,10 +328,38 @@ STDMETHODIMP MultiOutputStream::Seek(Int64 offset, UInt32 seekOrigin,
   if (seekOrigin >= 3)
     return STG_E_INVALIDFUNCTION;
 
+  if (m_Buffered) {
+    Int64 base = seekOrigin == STREAM_SEEK_SET   ? 0
+                 : seekOrigin == STREAM_SEEK_CUR ? static_cast<Int64>(m_Position)
+                                                 : static_cast<Int64>(m_Buffer.size());
+    if (base + offset < 0)
+      return STG_E_INVALIDFUNCTION;
+    m_Position = static_cast<UInt64>(base + offset);
+    if (m_Position != m_ProcessedSize)
+      m_Sequential = false;
+    if (newPosition)
+      *newPosition = m_Position;
+    return S_OK;
+  }
+
+  // Unbuffered files can only be written sequentially, so we only support queries
+  // of the current position:
+  if (m_DirectPool) {
+    const UInt64 current = m_ProcessedSize;
+    const Int64 base = seekOrigin == STREAM_SEEK_CUR ? static_cast<Int64>(current) : 0;
+    if (seekOrigin == STREAM_SEEK_END || base + offset != static_cast<Int64>(current))
+      return STG_E_INVALIDFUNCTION;
+    if (newPosition)
+      *newPosition = current;
+    return S_OK;
+  }
+
   bool result = true;
   for (auto& file : m_Files) {
     UInt64 realNewPosition;
     result = file.Seek(offset, seekOrigin, realNewPosition);
+    if (result && realNewPosition != m_ProcessedSize)
+      m_Sequential = false;
     if (newPosition)
       *newPosition = realNewPosition;
   }
@@ -107,30 +368,59 @@ STDMETHODIMP MultiOutputStream::Seek(Int64 offset, UInt32 seekOrigin,
 
 STDMETHODIMP MultiOutputStream::SetSize(UInt64 newSize)
 {
+  Count(&IOCounters::setSizeCalls, 1);
+
+  if (newSize < m_ProcessedSize)
+    m_Sequential = false;
+  m_RequestedSize = newSize;
+
+  if (m_Buffered) {
+    m_Buffer.resize(newSize);
+    return S_OK;
+  }
+
+  // The final size of unbuffered files is set by Close():
+  if (m_DirectPool) {
+    return S_OK;
+  }
+
   bool result = true;
   for (auto& file : m_Files) {
-    UInt64 currentPos;
-    if (!file.Seek(0, FILE_CURRENT, currentPos))
-      return E_FAIL;
-    bool cresult = file.SetLength(newSize);
-    UInt64 currentPos2;
-    result = result && cresult && file.Seek(currentPos, currentPos2);
+    result = file.SetLengthKeepPosition(newSize) && result;
   }
   return result ? S_OK : E_FAIL;
 }
 
 HRESULT MultiOutputStream::GetSize(UInt64* size)
 {
+  if (m_Buffered) {
+    *size = m_Buffer.size();
+    return S_OK;
+  }
+  if (m_DirectPool) {
+    *size = m_ProcessedSize;
+    return S_OK;
+  }
   if (m_Files.empty()) {
     return ConvertBoolToHRESULT(false);
   }
   return ConvertBoolToHRESULT(m_Files[0].GetLength(*size));
 }
 
-bool MultiOutputStream::SetMTime(FILETIME const* mTime)
+bool MultiOutputStream::Preallocate(UInt64 size)
 {
+  bool result = true;
   for (auto& file : m_Files) {
-    file.SetMTime(mTime);
+    result = file.Preallocate(size) && result;
   }
-  return true;
+  return result;
+}
+
+bool MultiOutputStream::SetMetadata(FILETIME const* mTime, UInt32 attributes)
+{
+  bool result = true;
+  for (auto& file : m_Files) {
+    result = file.SetBasicInfo(mTime, attributes) && result;
+  }
+  return result;
 }
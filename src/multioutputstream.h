@@ -24,11 +24,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <filesystem>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <vector>
 
 #include "7zip/IStream.h"
 
+#include "alignedbuffer.h"
+#include "cancellation.h"
+#include "contenthasher.h"
+#include "crc32.h"
 #include "fileio.h"
+#include "iocounters.h"
+#include "tracer.h"
 #include "unknown_impl.h"
 
 /** This class allows you to open and output to multiple file handles at a time.
@@ -49,7 +56,11 @@ public:
   // in total.
   using WriteCallback = std::function<void(UInt32, UInt64)>;
 
-  MultiOutputStream(WriteCallback callback = {});
+  // If a cancellation token is given, writes fail with E_ABORT once it is canceled.
+  // If counters are given, the I/O of the stream is added to them.
+  MultiOutputStream(WriteCallback callback = {},
+                    CancellationToken const* cancelToken = nullptr,
+                    IOCounters* ioCounters               = nullptr);
 
   virtual ~MultiOutputStream();
 
@@ -59,18 +70,84 @@ public:
    */
   bool Open(std::vector<std::filesystem::path> const& fileNames);
 
+  /** Use the given (already opened) files.
+   */
+  void Open(std::vector<IO::FileOut> files);
+
+  /** Opens the supplied files for unbuffered (direct) writing
+   *
+   * Written data goes through a buffer from the given pool so that the files only
+   * receive aligned writes. The last write is padded, and the files are truncated
+   * to their actual size by Close().
+   *
+   * @returns true if all went OK, false if any file failed to open or the sector
+   *   size of the volume is not compatible with the buffers of the pool
+   */
+  bool OpenDirect(std::vector<std::filesystem::path> const& fileNames,
+                  AlignedBufferPool& bufferPool);
+
+  /** Keep the written data in memory instead of writing it to files.
+   *
+   * The data can be retrieved with TakeBuffer() once the entry is complete.
+   */
+  void OpenBuffered(UInt64 expectedSize);
+
+  bool IsBuffered() const { return m_Buffered; }
+
+  /** Retrieve the data written to this stream when opened with OpenBuffered()
+   */
+  std::vector<unsigned char> TakeBuffer();
+
+  /** Writes any data pending in the direct I/O buffer and truncates the files to
+   * their actual size. Does nothing for regular files.
+   */
+  HRESULT Flush();
+
+  /** Give away the files opened by the last open, e.g. to close them elsewhere
+   *
+   * Flush() must be called before if the files were opened with OpenDirect().
+   */
+  std::vector<IO::FileOut> TakeFiles();
+
   /** Closes all the files opened by the last open
    *
    * Note if there are any errors, the code will merely report the last one.
    */
   HRESULT Close();
 
-  /** Sets the modification time on the open files
+  /** Sets the modification time (if not null) and the attributes (if not 0) on the
+   * open files, through their handles
    *
-   * @returns true if all files had the time set succesfully, false otherwise
-   * note that this will give up as soon as it gets an error
+   * @returns true if all files had the metadata set succesfully, false otherwise
    */
-  bool SetMTime(FILETIME const* mTime);
+  bool SetMetadata(FILETIME const* mTime, UInt32 attributes);
+
+  /** Reserve disk space for the open files, without changing their size
+   *
+   * @returns true if space was reserved for all the files, false otherwise
+   */
+  bool Preallocate(UInt64 size);
+
+  /** Hash the data written to this stream, starting with the next open
+   */
+  void EnableHashing();
+
+  /** Retrieve the hash of the data written since the last open
+   *
+   * @returns the hash, or nothing if hashing is not enabled or the data was not
+   *   written sequentially (in which case the hash would not match the content)
+   */
+  std::optional<FileData::ContentHash> GetHash() const;
+
+  /** Compute the CRC of the data written to this stream, starting with the next open
+   */
+  void EnableCRC();
+
+  /** Retrieve the CRC of the data written since the last open
+   *
+   * @returns the CRC, or nothing under the same conditions as GetHash()
+   */
+  std::optional<UInt32> GetCRC() const;
 
   // ISequentialOutStream interface
 
@@ -89,6 +166,8 @@ public:
 
 private:
   WriteCallback m_WriteCallback;
+  CancellationToken const* m_CancelToken;
+  IOCounters* m_IOCounters;
 
   /** This is the amount of data written to *any one* file.
    *
@@ -101,6 +180,33 @@ private:
    *
    */
   std::vector<IO::FileOut> m_Files;
+
+  /** In-memory content and current position, when buffered
+   *
+   */
+  bool m_Buffered;
+  std::vector<unsigned char> m_Buffer;
+  UInt64 m_Position;
+
+  /** Aligned buffer and its pool, and number of bytes pending in the buffer, when
+   * writing directly
+   */
+  AlignedBufferPool* m_DirectPool;
+  AlignedBufferPool::Buffer m_DirectBuffer;
+  std::size_t m_DirectBufferSize;
+
+  /** Hasher and CRC of the written data, if enabled, whether the data written so
+   * far was written sequentially, and the size last set with SetSize()
+   */
+  std::unique_ptr<ContentHasher> m_Hasher;
+  std::optional<Crc32> m_CRC;
+  bool m_Sequential;
+  UInt64 m_RequestedSize;
+
+  HRESULT FlushDirect(std::size_t size);
+  void ResetHash();
+  bool IsSequential() const;
+  void Count(IOCounters::Counter IOCounters::*counter, UInt64 value);
 };
 
 #endif  // MULTIOUTPUTSTREAM_H
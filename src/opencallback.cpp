@@ -21,8 +21,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "opencallback.h"
 #include <Unknwn.h>
 
+#include "countinginputstream.h"
 #include "inputstream.h"
 #include "propertyvariant.h"
+#include "readerinputstream.h"
 
 #include <atlbase.h>
 
@@ -38,9 +40,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 CArchiveOpenCallback::CArchiveOpenCallback(Archive::PasswordCallback passwordCallback,
                                            Archive::LogCallback logCallback,
-                                           std::filesystem::path const& filepath)
+                                           std::filesystem::path const& filepath,
+                                           Archive::OpenOptions const& openOptions,
+                                           std::shared_ptr<VolumeManager> volumes,
+                                           IOCounters* ioCounters,
+                                           CancellationToken const* cancelToken)
     : m_PasswordCallback(passwordCallback), m_LogCallback(logCallback),
-      m_Path(filepath), m_SubArchiveMode(false)
+      m_OpenOptions(openOptions), m_Volumes(std::move(volumes)),
+      m_IOCounters(ioCounters), m_CancelToken(cancelToken), m_Path(filepath),
+      m_StreamMode(false), m_StreamSize(0), m_SubArchiveMode(false)
 {
   if (!exists(filepath)) {
     throw std::runtime_error("invalid archive path");
@@ -51,6 +59,18 @@ CArchiveOpenCallback::CArchiveOpenCallback(Archive::PasswordCallback passwordCal
   }
 }
 
+CArchiveOpenCallback::CArchiveOpenCallback(Archive::PasswordCallback passwordCallback,
+                                           Archive::LogCallback logCallback,
+                                           std::wstring const& name, UInt64 size,
+                                           Archive::VolumeResolver volumeResolver,
+                                           IOCounters* ioCounters,
+                                           CancellationToken const* cancelToken)
+    : m_PasswordCallback(passwordCallback), m_LogCallback(logCallback),
+      m_IOCounters(ioCounters), m_CancelToken(cancelToken), m_Path(name),
+      m_StreamMode(true), m_StreamSize(size),
+      m_VolumeResolver(std::move(volumeResolver)), m_SubArchiveMode(false)
+{}
+
 /* -------------------- IArchiveOpenCallback -------------------- */
 STDMETHODIMP CArchiveOpenCallback::SetTotal(const UInt64* UNUSED(files),
                                             const UInt64* UNUSED(bytes)) throw()
@@ -61,7 +81,7 @@ STDMETHODIMP CArchiveOpenCallback::SetTotal(const UInt64* UNUSED(files),
 STDMETHODIMP CArchiveOpenCallback::SetCompleted(const UInt64* UNUSED(files),
                                                 const UInt64* UNUSED(bytes)) throw()
 {
-  return S_OK;
+  return m_CancelToken->isCanceled() ? E_ABORT : S_OK;
 }
 
 /* -------------------- ICryptoGetTextPassword -------------------- */
@@ -97,6 +117,12 @@ STDMETHODIMP CArchiveOpenCallback::GetProperty(PROPID propID,
   // IArchiveOpenVolumeCallback interface ask for the file name and size.
   PropertyVariant& prop = *static_cast<PropertyVariant*>(value);
 
+  // Streams have no attributes or times, so these are left empty:
+  if (m_StreamMode && (propID == kpidAttrib || propID == kpidCTime ||
+                       propID == kpidATime || propID == kpidMTime)) {
+    return S_OK;
+  }
+
   switch (propID) {
   case kpidName: {
     if (m_SubArchiveMode) {
@@ -109,10 +135,10 @@ STDMETHODIMP CArchiveOpenCallback::GetProperty(PROPID propID,
   } break;
 
   case kpidIsDir:
-    prop = m_FileInfo.isDir();
+    prop = !m_StreamMode && m_FileInfo.isDir();
     break;
   case kpidSize:
-    prop = m_FileInfo.fileSize();
+    prop = m_StreamMode ? m_StreamSize : m_FileInfo.fileSize();
     break;
   case kpidAttrib:
     prop = m_FileInfo.fileAttributes();
@@ -147,24 +173,41 @@ STDMETHODIMP CArchiveOpenCallback::GetStream(const wchar_t* name,
     return S_FALSE;
   }
 
-  // `name` is just the filename, so build a path from the directory that
-  // contained the last file
-  const auto path = m_Path.parent_path() / name;
+  if (m_StreamMode) {
+    auto reader = m_VolumeResolver ? m_VolumeResolver(name) : nullptr;
+    if (!reader) {
+      return S_FALSE;
+    }
 
-  if (!exists(m_FileInfo.path()) || m_FileInfo.isDir()) {
-    return S_FALSE;
+    m_Path       = name;
+    m_StreamSize = reader->getSize();
+
+    CComPtr<IInStream> volume(new ReaderInputStream(std::move(reader)));
+    *inStream = CountInput(volume, m_IOCounters).Detach();
+    return S_OK;
   }
 
-  if (!IO::FileBase::GetFileInformation(path, &m_FileInfo)) {
-    return S_FALSE;
+  // Volumes are usually found by the volume manager, without querying the file:
+  if (!m_Volumes || !m_Volumes->find(name, m_FileInfo)) {
+    // `name` is just the filename, so build a path from the directory that
+    // contained the last file
+    const auto path = m_Path.parent_path() / name;
+
+    if (!exists(m_FileInfo.path()) || m_FileInfo.isDir()) {
+      return S_FALSE;
+    }
+
+    if (!IO::FileBase::GetFileInformation(path, &m_FileInfo)) {
+      return S_FALSE;
+    }
   }
 
-  CComPtr<InputStream> inFile(new InputStream);
+  CComPtr<IInStream> inFile = OpenInputStream(m_FileInfo.path(), m_OpenOptions);
 
-  if (!inFile->Open(m_FileInfo.path())) {
+  if (!inFile) {
     return ::GetLastError();
   }
 
-  *inStream = inFile.Detach();
+  *inStream = CountInput(inFile, m_IOCounters).Detach();
   return S_OK;
 }
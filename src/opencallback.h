@@ -22,14 +22,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define OPENCALLBACK_H
 
 #include <filesystem>
+#include <memory>
 #include <string>
 
 #include "7zip/Archive/IArchive.h"
 #include "7zip/IPassword.h"
 
 #include "archive.h"
+#include "cancellation.h"
 #include "fileio.h"
+#include "iocounters.h"
 #include "unknown_impl.h"
+#include "volumemanager.h"
 
 class CArchiveOpenCallback : public IArchiveOpenCallback,
                              public IArchiveOpenVolumeCallback,
@@ -43,7 +47,17 @@ class CArchiveOpenCallback : public IArchiveOpenCallback,
 public:
   CArchiveOpenCallback(Archive::PasswordCallback passwordCallback,
                        Archive::LogCallback logCallback,
-                       std::filesystem::path const& filepath);
+                       std::filesystem::path const& filepath,
+                       Archive::OpenOptions const& openOptions,
+                       std::shared_ptr<VolumeManager> volumes,
+                       IOCounters* ioCounters, CancellationToken const* cancelToken);
+
+  // Callback for an archive opened from memory or from a stream, whose other
+  // volumes are retrieved through the given resolver (if any).
+  CArchiveOpenCallback(Archive::PasswordCallback passwordCallback,
+                       Archive::LogCallback logCallback, std::wstring const& name,
+                       UInt64 size, Archive::VolumeResolver volumeResolver,
+                       IOCounters* ioCounters, CancellationToken const* cancelToken);
 
   ~CArchiveOpenCallback() {}
 
@@ -63,11 +77,21 @@ public:
 private:
   Archive::PasswordCallback m_PasswordCallback;
   Archive::LogCallback m_LogCallback;
+  Archive::OpenOptions m_OpenOptions;
+  std::shared_ptr<VolumeManager> m_Volumes;
+  IOCounters* m_IOCounters;
+  CancellationToken const* m_CancelToken;
   std::wstring m_Password;
 
   std::filesystem::path m_Path;
   IO::FileInfo m_FileInfo;
 
+  // Set when the archive is not a file, in which case m_FileInfo is not valid and
+  // m_StreamSize is the size of the current volume.
+  bool m_StreamMode;
+  UInt64 m_StreamSize;
+  Archive::VolumeResolver m_VolumeResolver;
+
   bool m_SubArchiveMode;
   std::wstring m_SubArchiveName;
 };
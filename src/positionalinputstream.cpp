@@ -0,0 +1,169 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "positionalinputstream.h"
+#include <Unknwn.h>
+
+#include <algorithm>
+#include <cstring>
+
+// Size of the pages of the cache, and size above which reads bypass the cache, since
+// large reads are rarely repeated and would evict everything else.
+static constexpr UInt64 CACHE_PAGE_SIZE = 64 * 1024;
+static constexpr UInt64 MAX_CACHED_READ = 4 * CACHE_PAGE_SIZE;
+
+//////////////////////////
+// SharedFile
+
+std::shared_ptr<SharedFile> SharedFile::Open(std::filesystem::path const& filename,
+                                             std::size_t cacheSize)
+{
+  std::shared_ptr<SharedFile> file(new SharedFile(cacheSize));
+  if (!file->m_File.OpenOverlapped(filename) ||
+      !file->m_File.GetLength(file->m_Size)) {
+    return nullptr;
+  }
+  return file;
+}
+
+SharedFile::SharedFile(std::size_t cacheSize)
+    : m_Size(0), m_MaxPages(static_cast<std::size_t>(cacheSize / CACHE_PAGE_SIZE))
+{}
+
+SharedFile::Page SharedFile::GetPage(UInt64 index)
+{
+  {
+    std::scoped_lock lock(m_Mutex);
+    auto it = m_PageIndex.find(index);
+    if (it != m_PageIndex.end()) {
+      m_Pages.splice(m_Pages.begin(), m_Pages, it->second);
+      return it->second->second;
+    }
+  }
+
+  // Two streams may read the same page at the same time, in which case we simply
+  // keep the first one:
+  auto data = std::make_shared<std::vector<unsigned char>>(CACHE_PAGE_SIZE);
+  UInt32 processedSize;
+  if (!m_File.ReadAt(index * CACHE_PAGE_SIZE, data->data(),
+                     static_cast<UInt32>(CACHE_PAGE_SIZE), processedSize)) {
+    return nullptr;
+  }
+  data->resize(processedSize);
+
+  std::scoped_lock lock(m_Mutex);
+  auto it = m_PageIndex.find(index);
+  if (it != m_PageIndex.end()) {
+    return it->second->second;
+  }
+
+  m_Pages.emplace_front(index, std::move(data));
+  m_PageIndex[index] = m_Pages.begin();
+  if (m_Pages.size() > m_MaxPages) {
+    m_PageIndex.erase(m_Pages.back().first);
+    m_Pages.pop_back();
+  }
+
+  return m_Pages.front().second;
+}
+
+bool SharedFile::Read(UInt64 offset, void* data, UInt32 size, UInt32& processedSize)
+{
+  if (m_MaxPages == 0 || size > MAX_CACHED_READ) {
+    return m_File.ReadAt(offset, data, size, processedSize);
+  }
+
+  processedSize = 0;
+  auto* bytes   = static_cast<unsigned char*>(data);
+  while (size > 0 && offset < m_Size) {
+    auto page = GetPage(offset / CACHE_PAGE_SIZE);
+    if (!page) {
+      return false;
+    }
+
+    // The page is shorter at the end of the file:
+    const std::size_t start = static_cast<std::size_t>(offset % CACHE_PAGE_SIZE);
+    if (start >= page->size()) {
+      break;
+    }
+
+    const UInt32 length =
+        static_cast<UInt32>(std::min<std::size_t>(size, page->size() - start));
+    std::memcpy(bytes, page->data() + start, length);
+    bytes += length;
+    size -= length;
+    offset += length;
+    processedSize += length;
+  }
+
+  return true;
+}
+
+//////////////////////////
+// PositionalInputStream
+
+PositionalInputStream::PositionalInputStream(std::shared_ptr<SharedFile> file)
+    : m_File(std::move(file)), m_Position(0)
+{}
+
+PositionalInputStream::~PositionalInputStream() {}
+
+STDMETHODIMP PositionalInputStream::Read(void* data, UInt32 size,
+                                         UInt32* processedSize)
+{
+  UInt32 realProcessedSize = 0;
+  bool result              = m_File->Read(m_Position, data, size, realProcessedSize);
+  m_Position += realProcessedSize;
+
+  if (processedSize != nullptr) {
+    *processedSize = realProcessedSize;
+  }
+
+  return ConvertBoolToHRESULT(result);
+}
+
+STDMETHODIMP PositionalInputStream::Seek(Int64 offset, UInt32 seekOrigin,
+                                         UInt64* newPosition)
+{
+  Int64 base;
+  switch (seekOrigin) {
+  case STREAM_SEEK_SET:
+    base = 0;
+    break;
+  case STREAM_SEEK_CUR:
+    base = static_cast<Int64>(m_Position);
+    break;
+  case STREAM_SEEK_END:
+    base = static_cast<Int64>(m_File->GetSize());
+    break;
+  default:
+    return STG_E_INVALIDFUNCTION;
+  }
+
+  if (base + offset < 0) {
+    return HRESULT_FROM_WIN32(ERROR_NEGATIVE_SEEK);
+  }
+
+  m_Position = static_cast<UInt64>(base + offset);
+  if (newPosition) {
+    *newPosition = m_Position;
+  }
+  return S_OK;
+}
@@ -0,0 +1,111 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_POSITIONALINPUTSTREAM_H
+#define ARCHIVE_POSITIONALINPUTSTREAM_H
+
+#include "7zip/IStream.h"
+
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "fileio.h"
+#include "unknown_impl.h"
+
+/**
+ * A file opened once for overlapped I/O and read with positional reads, so that it
+ * can be read by multiple streams (see PositionalInputStream) from multiple threads
+ * at the same time.
+ *
+ * Small reads can go through a cache of pages shared by all the streams, so that
+ * data read by one stream (e.g., the headers of the archive) does not have to be
+ * read again by the others.
+ */
+class SharedFile
+{
+public:
+  /**
+   * @brief Open the given file.
+   *
+   * @param filename Path to the file.
+   * @param cacheSize Size of the page cache, in bytes. 0 disables the cache.
+   *
+   * @return the shared file, or null if the file could not be opened.
+   */
+  static std::shared_ptr<SharedFile> Open(std::filesystem::path const& filename,
+                                          std::size_t cacheSize);
+
+  SharedFile(SharedFile const&)            = delete;
+  SharedFile& operator=(SharedFile const&) = delete;
+
+  UInt64 GetSize() const { return m_Size; }
+
+  /**
+   * @brief Read at the given offset. Thread-safe.
+   */
+  bool Read(UInt64 offset, void* data, UInt32 size, UInt32& processedSize);
+
+private:
+  using Page = std::shared_ptr<const std::vector<unsigned char>>;
+
+  SharedFile(std::size_t cacheSize);
+
+  // Retrieve the given page, reading it if it is not in the cache.
+  Page GetPage(UInt64 index);
+
+  IO::FileIn m_File;
+  UInt64 m_Size;
+
+  // Pages, most recently used first, with an index to find them.
+  std::size_t m_MaxPages;
+  std::list<std::pair<UInt64, Page>> m_Pages;
+  std::unordered_map<UInt64, decltype(m_Pages)::iterator> m_PageIndex;
+  std::mutex m_Mutex;
+};
+
+/** This class implements an input stream over a SharedFile
+ *
+ * Each stream only has its own position, so multiple streams (e.g., given to
+ * multiple instances of a handler) can read the same file concurrently without
+ * opening it again.
+ */
+class PositionalInputStream : public IInStream
+{
+
+  UNKNOWN_1_INTERFACE(IInStream);
+
+public:
+  PositionalInputStream(std::shared_ptr<SharedFile> file);
+
+  virtual ~PositionalInputStream();
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+private:
+  std::shared_ptr<SharedFile> m_File;
+  UInt64 m_Position;
+};
+
+#endif
@@ -0,0 +1,174 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "preallocator.h"
+
+#include <algorithm>
+
+Preallocator::Preallocator(std::vector<Entry> entries, std::size_t lookahead,
+                           bool preallocate)
+    : m_Lookahead(lookahead), m_Preallocate(preallocate), m_Next(0), m_Ready(0),
+      m_Stop(false)
+{
+  m_Slots.reserve(entries.size());
+  for (auto& entry : entries) {
+    m_SlotIndices[entry.index] = m_Slots.size();
+    m_Slots.push_back({std::move(entry), State::Pending, {}});
+  }
+
+  m_Thread = std::thread(&Preallocator::run, this);
+}
+
+Preallocator::~Preallocator()
+{
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Stop = true;
+  }
+  m_Condition.notify_all();
+  m_Thread.join();
+
+  // These files were created for entries that were never extracted (e.g., because
+  // the extraction was cancelled), so we do not leave them behind:
+  for (auto& slot : m_Slots) {
+    if (slot.state == State::Ready) {
+      discard(slot.entry, slot.files);
+    }
+  }
+}
+
+bool Preallocator::take(UInt32 index, std::vector<IO::FileOut>& files)
+{
+  auto it = m_SlotIndices.find(index);
+  if (it == m_SlotIndices.end()) {
+    return false;
+  }
+
+  std::unique_lock lock(m_Mutex);
+  auto& slot = m_Slots[it->second];
+
+  // The helper thread should never stay behind the decoder:
+  m_Next = std::max(m_Next, it->second + 1);
+
+  m_Condition.wait(lock, [&slot] {
+    return slot.state != State::Preparing;
+  });
+
+  bool ready = slot.state == State::Ready;
+  if (ready) {
+    files = std::move(slot.files);
+    m_Ready--;
+  }
+  slot.state = State::Taken;
+
+  lock.unlock();
+  m_Condition.notify_all();
+
+  return ready;
+}
+
+void Preallocator::run()
+{
+  std::unique_lock lock(m_Mutex);
+  while (true) {
+    m_Condition.wait(lock, [this] {
+      return m_Stop || (m_Next < m_Slots.size() && m_Ready < m_Lookahead);
+    });
+
+    if (m_Stop) {
+      return;
+    }
+
+    auto& slot = m_Slots[m_Next++];
+    if (slot.state != State::Pending) {
+      continue;
+    }
+    slot.state = State::Preparing;
+
+    lock.unlock();
+    std::vector<IO::FileOut> files;
+    bool ok = prepare(slot.entry, files);
+    lock.lock();
+
+    if (ok) {
+      slot.files = std::move(files);
+      slot.state = State::Ready;
+      m_Ready++;
+    } else {
+      slot.state = State::Failed;
+    }
+
+    m_Condition.notify_all();
+  }
+}
+
+bool Preallocator::prepare(Entry const& entry, std::vector<IO::FileOut>& files) const
+{
+  namespace fs = std::filesystem;
+
+  // Existing files are left alone: they are only replaced once their entry is
+  // actually extracted, so that cancelling or failing the extraction does not lose
+  // them. The extraction callback takes care of these entries itself:
+  for (auto const& path : entry.paths) {
+    std::error_code ec;
+    if (fs::exists(path, ec) || ec) {
+      return false;
+    }
+  }
+
+  // Any failure here is reported by the extraction callback when it tries to do
+  // the same thing itself, so we simply give up:
+  for (auto const& path : entry.paths) {
+    std::error_code ec;
+    auto directoryPath = path.parent_path();
+    if (!fs::exists(directoryPath, ec)) {
+      fs::create_directories(directoryPath, ec);
+      if (ec) {
+        discard(entry, files);
+        return false;
+      }
+    }
+
+    files.emplace_back();
+    if (!files.back().Open(path, FILE_SHARE_READ, CREATE_NEW, FILE_ATTRIBUTE_NORMAL)) {
+      files.pop_back();
+      discard(entry, files);
+      return false;
+    }
+
+    // Not reserving the space is not an error, we just lose the benefits:
+    if (m_Preallocate && entry.size > 0) {
+      files.back().Preallocate(entry.size);
+    }
+  }
+
+  return true;
+}
+
+void Preallocator::discard(Entry const& entry, std::vector<IO::FileOut>& files)
+{
+  // Only the first files.size() paths were created by us:
+  const std::size_t created = files.size();
+  files.clear();
+  for (std::size_t i = 0; i < created; ++i) {
+    std::error_code ec;
+    std::filesystem::remove(entry.paths[i], ec);
+  }
+}
@@ -0,0 +1,113 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_PREALLOCATOR_H
+#define ARCHIVE_PREALLOCATOR_H
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fileio.h"
+
+/**
+ * Creates and preallocates the output files of upcoming entries on a helper thread,
+ * so that the extraction callback only has to pick up ready-to-write handles.
+ *
+ * Entries are prepared in the order they are given, at most `lookahead` entries
+ * ahead of the last one taken. An entry that has not been prepared when it is
+ * requested is simply skipped, and the caller is expected to open the files itself.
+ * This is also the case of entries whose files already exist, which are never
+ * touched before the entry is extracted.
+ */
+class Preallocator
+{
+public:
+  struct Entry
+  {
+    UInt32 index;
+    UInt64 size;
+    std::vector<std::filesystem::path> paths;
+  };
+
+  Preallocator(std::vector<Entry> entries, std::size_t lookahead, bool preallocate);
+
+  // Stop the helper thread and remove the files that were prepared but never taken.
+  ~Preallocator();
+
+  Preallocator(Preallocator const&)            = delete;
+  Preallocator& operator=(Preallocator const&) = delete;
+
+  /**
+   * @brief Retrieve the prepared files for the given entry.
+   *
+   * If the entry is being prepared, this waits for it to be ready.
+   *
+   * @param index Index of the entry.
+   * @param files Vector that receives the opened files, in the order of the paths
+   *     of the entry.
+   *
+   * @return true if the files were prepared, false otherwise (in which case the
+   *     caller must create them).
+   */
+  bool take(UInt32 index, std::vector<IO::FileOut>& files);
+
+private:
+  enum class State
+  {
+    Pending,
+    Preparing,
+    Ready,
+    Failed,
+    Taken
+  };
+
+  struct Slot
+  {
+    Entry entry;
+    State state;
+    std::vector<IO::FileOut> files;
+  };
+
+  void run();
+  bool prepare(Entry const& entry, std::vector<IO::FileOut>& files) const;
+
+  // Close and remove the given files, which were created for the given entry.
+  static void discard(Entry const& entry, std::vector<IO::FileOut>& files);
+
+  std::vector<Slot> m_Slots;
+  std::unordered_map<UInt32, std::size_t> m_SlotIndices;
+  std::size_t m_Lookahead;
+  bool m_Preallocate;
+
+  // Next slot to prepare, and number of slots ready but not yet taken.
+  std::size_t m_Next;
+  std::size_t m_Ready;
+
+  bool m_Stop;
+  std::mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::thread m_Thread;
+};
+
+#endif
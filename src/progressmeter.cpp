@@ -0,0 +1,115 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "progressmeter.h"
+
+ProgressMeter::ProgressMeter(std::chrono::milliseconds interval, uint64_t granularity)
+    : m_Interval(interval), m_Granularity(granularity), m_Completed(0), m_Total(0),
+      m_Files(0), m_Pending(false), m_Started(false), m_LastTime{},
+      m_LastCompleted(0), m_LastFiles(0), m_BytesPerSecond(0), m_FilesPerSecond(0)
+{}
+
+bool ProgressMeter::update(uint64_t completed, uint64_t total, uint64_t files,
+                           Archive::ProgressStats& stats)
+{
+  m_Completed = completed;
+  m_Total     = total;
+  m_Files     = files;
+  m_Pending   = true;
+
+  const auto now = Clock::now();
+
+  // The first update is only used as a starting point for the rates, unless it is
+  // also the last one:
+  if (!m_Started) {
+    m_Started       = true;
+    m_LastTime      = now;
+    m_LastCompleted = completed;
+    m_LastFiles     = files;
+    if (completed < total) {
+      return false;
+    }
+  }
+
+  const bool report =
+      completed >= total || now - m_LastTime >= m_Interval ||
+      (m_Granularity > 0 && completed >= m_LastCompleted + m_Granularity);
+  if (!report) {
+    return false;
+  }
+
+  fill(now, stats);
+  return true;
+}
+
+bool ProgressMeter::flush(Archive::ProgressStats& stats)
+{
+  if (!m_Pending) {
+    return false;
+  }
+
+  fill(Clock::now(), stats);
+  return true;
+}
+
+void ProgressMeter::fill(Clock::time_point now, Archive::ProgressStats& stats)
+{
+  const double elapsed = std::chrono::duration<double>(now - m_LastTime).count();
+
+  // Rates are only updated when some time has passed, otherwise the measures are
+  // meaningless:
+  if (elapsed > 0) {
+    const double bytesPerSecond =
+        (m_Completed >= m_LastCompleted ? m_Completed - m_LastCompleted : 0) /
+        elapsed;
+    const double filesPerSecond =
+        (m_Files >= m_LastFiles ? m_Files - m_LastFiles : 0) / elapsed;
+
+    if (m_BytesPerSecond == 0 && m_FilesPerSecond == 0) {
+      m_BytesPerSecond = bytesPerSecond;
+      m_FilesPerSecond = filesPerSecond;
+    } else {
+      m_BytesPerSecond = SMOOTHING_FACTOR * bytesPerSecond +
+                         (1 - SMOOTHING_FACTOR) * m_BytesPerSecond;
+      m_FilesPerSecond = SMOOTHING_FACTOR * filesPerSecond +
+                         (1 - SMOOTHING_FACTOR) * m_FilesPerSecond;
+    }
+  }
+
+  m_LastTime      = now;
+  m_LastCompleted = m_Completed;
+  m_LastFiles     = m_Files;
+  m_Pending       = false;
+
+  stats.completed      = m_Completed;
+  stats.total          = m_Total;
+  stats.files          = m_Files;
+  stats.bytesPerSecond = m_BytesPerSecond;
+  stats.filesPerSecond = m_FilesPerSecond;
+
+  if (m_Completed >= m_Total) {
+    stats.eta = std::chrono::milliseconds(0);
+  } else if (m_BytesPerSecond > 0) {
+    stats.eta = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::duration<double>((m_Total - m_Completed) / m_BytesPerSecond));
+  } else {
+    stats.eta = std::chrono::milliseconds(-1);
+  }
+}
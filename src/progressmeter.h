@@ -0,0 +1,92 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_PROGRESSMETER_H
+#define ARCHIVE_PROGRESSMETER_H
+
+#include <chrono>
+#include <cstdint>
+
+#include "archive.h"
+
+/**
+ * Coalesces progress updates of a single type (archive or extraction) and computes
+ * smoothed rates and remaining time for them.
+ *
+ * update() is called for every raw update and tells whether it should be forwarded
+ * to the user: an update is forwarded if enough time has passed since the last one
+ * forwarded, if enough bytes have been processed since then, or if it is the last
+ * one (i.e., completed reached total).
+ *
+ * This class is not thread-safe.
+ */
+class ProgressMeter
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  ProgressMeter(std::chrono::milliseconds interval, uint64_t granularity);
+
+  /**
+   * @brief Record an update.
+   *
+   * @param completed Number of bytes processed so far.
+   * @param total Total number of bytes to process.
+   * @param files Number of entries processed so far.
+   * @param stats Receives the statistics to report, if this returns true.
+   *
+   * @return true if the update should be reported, false otherwise.
+   */
+  bool update(uint64_t completed, uint64_t total, uint64_t files,
+              Archive::ProgressStats& stats);
+
+  /**
+   * @brief Retrieve the last update if it was not reported.
+   *
+   * @return true if there was an update that was not reported, false otherwise.
+   */
+  bool flush(Archive::ProgressStats& stats);
+
+private:
+  // Weight of the last measure in the smoothed rates.
+  static constexpr double SMOOTHING_FACTOR = 0.3;
+
+  void fill(Clock::time_point now, Archive::ProgressStats& stats);
+
+  std::chrono::milliseconds m_Interval;
+  uint64_t m_Granularity;
+
+  // Last update received.
+  uint64_t m_Completed;
+  uint64_t m_Total;
+  uint64_t m_Files;
+  bool m_Pending;
+
+  // State at the time of the last reported update.
+  bool m_Started;
+  Clock::time_point m_LastTime;
+  uint64_t m_LastCompleted;
+  uint64_t m_LastFiles;
+
+  double m_BytesPerSecond;
+  double m_FilesPerSecond;
+};
+
+#endif
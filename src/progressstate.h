@@ -0,0 +1,191 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_PROGRESSSTATE_H
+#define ARCHIVE_PROGRESSSTATE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "archive.h"
+
+/**
+ * Progress of an extraction, published by the extraction thread and read from any
+ * other thread without locking.
+ *
+ * The counters are protected by a sequence lock: the extraction thread is the only
+ * writer and never waits, while readers retry until they get a consistent snapshot.
+ *
+ * Events are pushed into a bounded single-producer, single-consumer ring. When the
+ * ring is full, new events are dropped (and counted) rather than blocking the
+ * extraction.
+ */
+class ProgressState
+{
+public:
+  // Number of events kept in the ring, must be a power of 2.
+  static constexpr std::size_t EVENT_CAPACITY = 1024;
+
+  ProgressState() { reset(); }
+
+  ProgressState(ProgressState const&)            = delete;
+  ProgressState& operator=(ProgressState const&) = delete;
+
+  // Writer side, only called from the extraction thread.
+
+  void reset()
+  {
+    write([this] {
+      m_BytesIn.store(0, std::memory_order_relaxed);
+      m_BytesOut.store(0, std::memory_order_relaxed);
+      m_CurrentIndex.store(Archive::ProgressSnapshot::NO_INDEX,
+                           std::memory_order_relaxed);
+      m_FilesDone.store(0, std::memory_order_relaxed);
+      m_Errors.store(0, std::memory_order_relaxed);
+      m_DroppedEvents.store(0, std::memory_order_relaxed);
+    });
+  }
+
+  void setBytesIn(uint64_t bytes)
+  {
+    write([=, this] {
+      m_BytesIn.store(bytes, std::memory_order_relaxed);
+    });
+  }
+
+  void addBytesOut(uint64_t bytes)
+  {
+    write([=, this] {
+      m_BytesOut.store(m_BytesOut.load(std::memory_order_relaxed) + bytes,
+                       std::memory_order_relaxed);
+    });
+  }
+
+  void startEntry(std::size_t index)
+  {
+    write([=, this] {
+      m_CurrentIndex.store(index, std::memory_order_relaxed);
+    });
+    push({Archive::ProgressEventType::ENTRY_START, index});
+  }
+
+  void endEntry()
+  {
+    const std::size_t index = m_CurrentIndex.load(std::memory_order_relaxed);
+    write([this] {
+      m_FilesDone.store(m_FilesDone.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+      m_CurrentIndex.store(Archive::ProgressSnapshot::NO_INDEX,
+                           std::memory_order_relaxed);
+    });
+    push({Archive::ProgressEventType::ENTRY_END, index});
+  }
+
+  void addError()
+  {
+    const std::size_t index = m_CurrentIndex.load(std::memory_order_relaxed);
+    write([this] {
+      m_Errors.store(m_Errors.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+    });
+    push({Archive::ProgressEventType::ERROR, index});
+  }
+
+  // Reader side, may be called from any thread (but pop() from only one at a time).
+
+  Archive::ProgressSnapshot snapshot() const
+  {
+    Archive::ProgressSnapshot snapshot;
+    uint64_t sequence;
+    do {
+      // An odd sequence means that a write is in progress:
+      do {
+        sequence = m_Sequence.load(std::memory_order_acquire);
+      } while (sequence & 1);
+
+      snapshot.bytesIn       = m_BytesIn.load(std::memory_order_relaxed);
+      snapshot.bytesOut      = m_BytesOut.load(std::memory_order_relaxed);
+      snapshot.currentIndex  = m_CurrentIndex.load(std::memory_order_relaxed);
+      snapshot.filesDone     = m_FilesDone.load(std::memory_order_relaxed);
+      snapshot.errors        = m_Errors.load(std::memory_order_relaxed);
+      snapshot.droppedEvents = m_DroppedEvents.load(std::memory_order_relaxed);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (m_Sequence.load(std::memory_order_relaxed) != sequence);
+
+    return snapshot;
+  }
+
+  bool pop(Archive::ProgressEvent& event)
+  {
+    const std::size_t tail = m_Tail.load(std::memory_order_relaxed);
+    if (tail == m_Head.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    event = m_Events[tail & (EVENT_CAPACITY - 1)];
+    m_Tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  static_assert((EVENT_CAPACITY & (EVENT_CAPACITY - 1)) == 0);
+
+  template <class Fn>
+  void write(Fn&& fn)
+  {
+    const uint64_t sequence = m_Sequence.load(std::memory_order_relaxed);
+    m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    fn();
+    m_Sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  void push(Archive::ProgressEvent const& event)
+  {
+    const std::size_t head = m_Head.load(std::memory_order_relaxed);
+    if (head - m_Tail.load(std::memory_order_acquire) == EVENT_CAPACITY) {
+      write([this] {
+        m_DroppedEvents.store(m_DroppedEvents.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+      });
+      return;
+    }
+
+    m_Events[head & (EVENT_CAPACITY - 1)] = event;
+    m_Head.store(head + 1, std::memory_order_release);
+  }
+
+  std::atomic<uint64_t> m_Sequence{0};
+  std::atomic<uint64_t> m_BytesIn;
+  std::atomic<uint64_t> m_BytesOut;
+  std::atomic<std::size_t> m_CurrentIndex;
+  std::atomic<uint64_t> m_FilesDone;
+  std::atomic<uint64_t> m_Errors;
+  std::atomic<uint64_t> m_DroppedEvents;
+
+  // Producer and consumer positions are on separate cache lines:
+  alignas(64) std::atomic<std::size_t> m_Head{0};
+  alignas(64) std::atomic<std::size_t> m_Tail{0};
+  std::array<Archive::ProgressEvent, EVENT_CAPACITY> m_Events;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_RANGESET_H
+#define ARCHIVE_RANGESET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+
+/**
+ * Set of disjoint [begin, end) ranges of offsets, e.g. the parts of a file that are
+ * available or that have been read. Adjacent ranges are merged, so data added in
+ * order only ever needs a single range.
+ */
+class RangeSet
+{
+public:
+  void insert(uint64_t begin, uint64_t end)
+  {
+    // Merge the new range with the ranges it overlaps or touches:
+    auto it = m_Ranges.upper_bound(begin);
+    if (it != m_Ranges.begin()) {
+      auto previous = std::prev(it);
+      if (previous->second >= begin) {
+        begin = previous->first;
+        end   = std::max(end, previous->second);
+        it    = m_Ranges.erase(previous);
+      }
+    }
+
+    while (it != m_Ranges.end() && it->first <= end) {
+      end = std::max(end, it->second);
+      it  = m_Ranges.erase(it);
+    }
+
+    m_Ranges[begin] = end;
+  }
+
+  // End of the contiguous range starting at the given offset, which is the offset
+  // itself if it is not in the set.
+  uint64_t coveredUntil(uint64_t offset) const
+  {
+    auto it = m_Ranges.upper_bound(offset);
+    if (it == m_Ranges.begin()) {
+      return offset;
+    }
+    return std::max(offset, std::prev(it)->second);
+  }
+
+  // Number of offsets of [begin, end) that are in the set.
+  uint64_t overlap(uint64_t begin, uint64_t end) const
+  {
+    uint64_t covered = 0;
+
+    auto it = m_Ranges.upper_bound(begin);
+    if (it != m_Ranges.begin()) {
+      --it;
+    }
+    for (; it != m_Ranges.end() && it->first < end; ++it) {
+      uint64_t from = std::max(it->first, begin), to = std::min(it->second, end);
+      if (from < to) {
+        covered += to - from;
+      }
+    }
+
+    return covered;
+  }
+
+private:
+  std::map<uint64_t, uint64_t> m_Ranges;
+};
+
+#endif
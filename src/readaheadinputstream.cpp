@@ -0,0 +1,267 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "readaheadinputstream.h"
+#include <Unknwn.h>
+
+#include <algorithm>
+#include <cstring>
+
+// Size of the first window after a sequential read starts.
+static constexpr std::size_t MIN_WINDOW_SIZE = 64 * 1024;
+
+ReadAheadInputStream::ReadAheadInputStream(std::size_t maxWindowSize,
+                                           std::size_t nWindows)
+    : m_MaxWindowSize(std::max(maxWindowSize, MIN_WINDOW_SIZE)), m_Size(0),
+      m_Position(0), m_LastReadEnd(0), m_Windows(std::max<std::size_t>(nWindows, 1)),
+      m_WindowSize(MIN_WINDOW_SIZE), m_Generation(0), m_NextOffset(0),
+      m_ReadingAhead(false), m_Stop(false)
+{}
+
+ReadAheadInputStream::~ReadAheadInputStream()
+{
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Stop = true;
+  }
+  m_WindowRequested.notify_all();
+
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+  }
+}
+
+bool ReadAheadInputStream::Open(std::filesystem::path const& filename)
+{
+  if (!m_File.Open(filename, FILE_SHARE_READ, OPEN_EXISTING,
+                   FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN |
+                       FILE_FLAG_OVERLAPPED) ||
+      !m_File.GetLength(m_Size)) {
+    return false;
+  }
+
+  m_Thread = std::thread(&ReadAheadInputStream::run, this);
+  return true;
+}
+
+void ReadAheadInputStream::Restart(UInt64 offset)
+{
+  // Windows being loaded belong to the loading thread, which drops them once
+  // loaded since their generation no longer matches:
+  m_Generation++;
+  for (auto& window : m_Windows) {
+    if (window.state == State::Ready) {
+      window.state = State::Empty;
+    }
+  }
+
+  m_NextOffset   = offset;
+  m_WindowSize   = MIN_WINDOW_SIZE;
+  m_ReadingAhead = true;
+  m_WindowRequested.notify_one();
+}
+
+void ReadAheadInputStream::ReleaseBefore(UInt64 offset)
+{
+  for (auto& window : m_Windows) {
+    if (window.state == State::Ready && window.offset + window.requested <= offset) {
+      window.state = State::Empty;
+      m_WindowRequested.notify_one();
+    }
+  }
+}
+
+ReadAheadInputStream::Window* ReadAheadInputStream::Find(UInt64 offset)
+{
+  for (auto& window : m_Windows) {
+    if (window.state == State::Empty || window.generation != m_Generation) {
+      continue;
+    }
+    // Windows cover what was requested even if the read was short, so that reads
+    // past the end of a truncated file do not restart reading ahead:
+    if (offset >= window.offset && offset < window.offset + window.requested) {
+      return &window;
+    }
+  }
+  return nullptr;
+}
+
+void ReadAheadInputStream::run()
+{
+  std::unique_lock lock(m_Mutex);
+  while (true) {
+    Window* window = nullptr;
+    m_WindowRequested.wait(lock, [this, &window] {
+      if (m_Stop) {
+        return true;
+      }
+      if (!m_ReadingAhead || m_NextOffset >= m_Size) {
+        return false;
+      }
+      auto it = std::find_if(m_Windows.begin(), m_Windows.end(), [](auto& w) {
+        return w.state == State::Empty;
+      });
+      window = it == m_Windows.end() ? nullptr : &*it;
+      return window != nullptr;
+    });
+
+    if (m_Stop) {
+      return;
+    }
+
+    window->state      = State::Loading;
+    window->generation = m_Generation;
+    window->offset     = m_NextOffset;
+    window->requested  = static_cast<std::size_t>(
+        std::min<UInt64>(m_WindowSize, m_Size - m_NextOffset));
+    m_NextOffset += window->requested;
+    lock.unlock();
+
+    // The window belongs to this thread while it is loading:
+    if (window->data.size() < window->requested) {
+      window->data.resize(window->requested);
+    }
+    UInt32 processedSize = 0;
+    const bool ok        = m_File.ReadAt(window->offset, window->data.data(),
+                                         static_cast<UInt32>(window->requested),
+                                         processedSize);
+
+    lock.lock();
+    if (window->generation == m_Generation) {
+      window->state  = State::Ready;
+      window->size   = processedSize;
+      window->failed = !ok;
+    } else {
+      window->state = State::Empty;
+      m_WindowRequested.notify_one();
+    }
+    m_WindowLoaded.notify_all();
+  }
+}
+
+STDMETHODIMP ReadAheadInputStream::Read(void* data, UInt32 size, UInt32* processedSize)
+{
+  if (processedSize != nullptr) {
+    *processedSize = 0;
+  }
+
+  auto* bytes           = static_cast<unsigned char*>(data);
+  const bool sequential = m_Position == m_LastReadEnd;
+
+  std::unique_lock lock(m_Mutex);
+  while (size > 0 && m_Position < m_Size) {
+    Window* window = Find(m_Position);
+
+    if (window == nullptr) {
+      if (sequential) {
+        // The next window may already be on its way:
+        if (!m_ReadingAhead || m_NextOffset != m_Position) {
+          Restart(m_Position);
+        } else {
+          ReleaseBefore(m_Position);
+        }
+        m_WindowLoaded.wait(lock);
+        continue;
+      }
+
+      // Reads at random offsets are usually small, so we read them directly:
+      lock.unlock();
+      UInt32 realProcessedSize = 0;
+      const bool ok = m_File.ReadAt(m_Position, bytes, size, realProcessedSize);
+      m_Position += realProcessedSize;
+      if (processedSize != nullptr) {
+        *processedSize += realProcessedSize;
+      }
+      m_LastReadEnd = m_Position;
+      return ConvertBoolToHRESULT(ok);
+    }
+
+    if (window->state == State::Loading) {
+      m_WindowLoaded.wait(lock);
+      continue;
+    }
+
+    if (window->failed) {
+      // Let the next read try again:
+      window->state = State::Empty;
+      m_WindowRequested.notify_one();
+      return HRESULT_FROM_WIN32(ERROR_READ_FAULT);
+    }
+
+    // Short read, i.e., the file was truncated since it was opened:
+    const std::size_t start = static_cast<std::size_t>(m_Position - window->offset);
+    if (start >= window->size) {
+      break;
+    }
+
+    // Only this thread releases ready windows, so the data can be copied without
+    // holding the lock:
+    lock.unlock();
+    const std::size_t length = std::min<std::size_t>(size, window->size - start);
+    std::memcpy(bytes, window->data.data() + start, length);
+    bytes += length;
+    size -= static_cast<UInt32>(length);
+    m_Position += length;
+    if (processedSize != nullptr) {
+      *processedSize += static_cast<UInt32>(length);
+    }
+    lock.lock();
+
+    // The window has been consumed, so we move on with a larger one:
+    if (start + length == window->requested) {
+      window->state = State::Empty;
+      m_WindowSize  = std::min(m_WindowSize * 2, m_MaxWindowSize);
+      m_WindowRequested.notify_one();
+    }
+  }
+
+  m_LastReadEnd = m_Position;
+  return S_OK;
+}
+
+STDMETHODIMP ReadAheadInputStream::Seek(Int64 offset, UInt32 seekOrigin,
+                                        UInt64* newPosition)
+{
+  Int64 base;
+  switch (seekOrigin) {
+  case STREAM_SEEK_SET:
+    base = 0;
+    break;
+  case STREAM_SEEK_CUR:
+    base = static_cast<Int64>(m_Position);
+    break;
+  case STREAM_SEEK_END:
+    base = static_cast<Int64>(m_Size);
+    break;
+  default:
+    return STG_E_INVALIDFUNCTION;
+  }
+
+  if (base + offset < 0) {
+    return HRESULT_FROM_WIN32(ERROR_NEGATIVE_SEEK);
+  }
+
+  // The windows are kept, in case the next reads fall in them:
+  m_Position = static_cast<UInt64>(base + offset);
+  if (newPosition) {
+    *newPosition = m_Position;
+  }
+  return S_OK;
+}
@@ -0,0 +1,119 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_READAHEADINPUTSTREAM_H
+#define ARCHIVE_READAHEADINPUTSTREAM_H
+
+#include "7zip/IStream.h"
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fileio.h"
+#include "unknown_impl.h"
+
+/** This class implements an input stream that reads ahead of sequential reads
+ *
+ * When a read starts where the previous one ended, a background thread starts
+ * reading the following windows of the file into a ring of buffers, and reads are
+ * served from these buffers. Windows start small and double every time one is fully
+ * consumed, up to a maximum size.
+ *
+ * Seeking is free: the windows are only discarded when a sequential read starts
+ * somewhere else, and reads at random offsets that are not already buffered go
+ * directly to the file.
+ */
+class ReadAheadInputStream : public IInStream
+{
+
+  UNKNOWN_1_INTERFACE(IInStream);
+
+public:
+  ReadAheadInputStream(std::size_t maxWindowSize, std::size_t nWindows);
+
+  // Stop the background thread.
+  virtual ~ReadAheadInputStream();
+
+  bool Open(std::filesystem::path const& filename);
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+private:
+  enum class State
+  {
+    Empty,
+    Loading,
+    Ready
+  };
+
+  struct Window
+  {
+    State state = State::Empty;
+    UInt64 generation;
+    UInt64 offset;
+    std::size_t requested;
+    std::size_t size;
+    bool failed;
+    std::vector<unsigned char> data;
+  };
+
+  void run();
+
+  // Discard all the windows and start reading ahead from the given offset. Must be
+  // called with m_Mutex locked.
+  void Restart(UInt64 offset);
+
+  // Release the ready windows that end before the given offset, which will not be
+  // read since reads are sequential. Must be called with m_Mutex locked.
+  void ReleaseBefore(UInt64 offset);
+
+  // Window containing the given offset (including windows being loaded), if any.
+  // Must be called with m_Mutex locked.
+  Window* Find(UInt64 offset);
+
+  const std::size_t m_MaxWindowSize;
+
+  // The file is opened for overlapped I/O and read with positional reads, so both
+  // threads can read it at the same time.
+  IO::FileIn m_File;
+  UInt64 m_Size;
+
+  // Only accessed by the reading thread.
+  UInt64 m_Position;
+  UInt64 m_LastReadEnd;
+
+  std::vector<Window> m_Windows;
+  std::size_t m_WindowSize;
+  UInt64 m_Generation;
+  UInt64 m_NextOffset;
+  bool m_ReadingAhead;
+  bool m_Stop;
+
+  std::mutex m_Mutex;
+  std::condition_variable m_WindowRequested;
+  std::condition_variable m_WindowLoaded;
+  std::thread m_Thread;
+};
+
+#endif
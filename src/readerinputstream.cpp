@@ -0,0 +1,122 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "readerinputstream.h"
+#include <Unknwn.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+bool MemoryReader::read(uint64_t offset, void* buffer, std::size_t size,
+                        std::size_t* bytesRead)
+{
+  std::size_t available = 0;
+  if (offset < m_Data.size()) {
+    available = std::min<std::size_t>(size, m_Data.size() - offset);
+    std::memcpy(buffer, m_Data.data() + offset, available);
+  }
+
+  if (bytesRead != nullptr) {
+    *bytesRead = available;
+  }
+  return true;
+}
+
+ReaderInputStream::ReaderInputStream(std::shared_ptr<ArchiveStreamReader> reader)
+    : m_Reader(std::move(reader)), m_Position(0)
+{}
+
+ReaderInputStream::~ReaderInputStream() {}
+
+STDMETHODIMP ReaderInputStream::Read(void* data, UInt32 size, UInt32* processedSize)
+{
+  std::size_t realProcessedSize = 0;
+  bool result = m_Reader->read(m_Position, data, size, &realProcessedSize);
+  m_Position += realProcessedSize;
+
+  if (processedSize != nullptr) {
+    *processedSize = static_cast<UInt32>(realProcessedSize);
+  }
+
+  return result ? S_OK : E_FAIL;
+}
+
+STDMETHODIMP ReaderInputStream::Seek(Int64 offset, UInt32 seekOrigin,
+                                     UInt64* newPosition)
+{
+  Int64 base;
+  switch (seekOrigin) {
+  case STREAM_SEEK_SET:
+    base = 0;
+    break;
+  case STREAM_SEEK_CUR:
+    base = static_cast<Int64>(m_Position);
+    break;
+  case STREAM_SEEK_END:
+    base = static_cast<Int64>(m_Reader->getSize());
+    break;
+  default:
+    return STG_E_INVALIDFUNCTION;
+  }
+
+  if (base + offset < 0) {
+    return HRESULT_FROM_WIN32(ERROR_NEGATIVE_SEEK);
+  }
+
+  m_Position = static_cast<UInt64>(base + offset);
+  if (newPosition) {
+    *newPosition = m_Position;
+  }
+  return S_OK;
+}
+
+SequentialInputStream::SequentialInputStream(
+    std::shared_ptr<ArchiveStreamReader> reader, std::string header,
+    IOCounters* counters)
+    : m_Reader(std::move(reader)), m_Header(std::move(header)), m_Counters(counters),
+      m_Position(0)
+{}
+
+SequentialInputStream::~SequentialInputStream() {}
+
+STDMETHODIMP SequentialInputStream::Read(void* data, UInt32 size,
+                                         UInt32* processedSize)
+{
+  std::size_t realProcessedSize = 0;
+  bool result                   = true;
+  if (m_Position < m_Header.size()) {
+    realProcessedSize = std::min<std::size_t>(size, m_Header.size() - m_Position);
+    std::memcpy(data, m_Header.data() + m_Position, realProcessedSize);
+  } else {
+    result = m_Reader->read(m_Position, data, size, &realProcessedSize);
+    if (m_Counters != nullptr) {
+      IOCounters::add(m_Counters->readCalls, 1);
+      IOCounters::add(m_Counters->bytesRead, realProcessedSize);
+    }
+  }
+  m_Position += realProcessedSize;
+
+  if (processedSize != nullptr) {
+    *processedSize = static_cast<UInt32>(realProcessedSize);
+  }
+
+  return result ? S_OK : E_FAIL;
+}
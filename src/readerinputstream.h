@@ -0,0 +1,103 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_READERINPUTSTREAM_H
+#define ARCHIVE_READERINPUTSTREAM_H
+
+#include "7zip/IStream.h"
+
+#include <memory>
+#include <span>
+#include <string>
+
+#include "archive.h"
+#include "iocounters.h"
+#include "unknown_impl.h"
+
+/**
+ * Reader over an archive stored in memory, see Archive::openFromMemory().
+ *
+ * The data is not copied, so it must outlive the reader.
+ */
+class MemoryReader : public ArchiveStreamReader
+{
+public:
+  MemoryReader(std::span<const std::byte> data) : m_Data(data) {}
+
+  uint64_t getSize() const override { return m_Data.size(); }
+
+  bool read(uint64_t offset, void* buffer, std::size_t size,
+            std::size_t* bytesRead) override;
+
+private:
+  std::span<const std::byte> m_Data;
+};
+
+/** This class implements an input stream over an ArchiveStreamReader
+ *
+ * Like PositionalInputStream, each stream only has its own position, so multiple
+ * streams can read the same source concurrently.
+ */
+class ReaderInputStream : public IInStream
+{
+
+  UNKNOWN_1_INTERFACE(IInStream);
+
+public:
+  ReaderInputStream(std::shared_ptr<ArchiveStreamReader> reader);
+
+  virtual ~ReaderInputStream();
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+private:
+  std::shared_ptr<ArchiveStreamReader> m_Reader;
+  UInt64 m_Position;
+};
+
+/** This class implements a sequential input stream over an ArchiveStreamReader
+ *
+ * The start of the archive, read beforehand to find its format, is given to the
+ * stream so that the reader itself is only ever read forward. Handlers cannot seek
+ * this stream, so it counts its reads itself instead of going through a
+ * CountingInputStream.
+ */
+class SequentialInputStream : public ISequentialInStream
+{
+
+  UNKNOWN_1_INTERFACE(ISequentialInStream);
+
+public:
+  SequentialInputStream(std::shared_ptr<ArchiveStreamReader> reader,
+                        std::string header, IOCounters* counters);
+
+  virtual ~SequentialInputStream();
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+
+private:
+  std::shared_ptr<ArchiveStreamReader> m_Reader;
+  std::string m_Header;
+  IOCounters* m_Counters;
+  UInt64 m_Position;
+};
+
+#endif
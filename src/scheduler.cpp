@@ -0,0 +1,208 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "scheduler.h"
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "formatter.h"
+
+ExtractionScheduler::Job::Job(ExtractionScheduler& scheduler, std::wstring device,
+                              CancellationToken const& cancelToken)
+    : m_Scheduler(scheduler), m_Device(std::move(device)), m_CancelToken(cancelToken),
+      m_Bytes(0)
+{}
+
+ExtractionScheduler::Job::~Job()
+{
+  m_Scheduler.leave(*this);
+}
+
+void ExtractionScheduler::Job::post(Task task)
+{
+  {
+    std::scoped_lock lock(m_Scheduler.m_Mutex);
+    if (m_Tasks.empty()) {
+      m_Scheduler.m_ReadyJobs.push_back(this);
+    }
+    m_Tasks.push_back(std::move(task));
+  }
+  m_Scheduler.m_TaskAvailable.notify_one();
+}
+
+bool ExtractionScheduler::Job::acquireBytes(uint64_t bytes)
+{
+  std::unique_lock lock(m_Scheduler.m_Mutex);
+  while (m_Bytes > 0 && m_Scheduler.m_InFlightBytes + bytes >
+                            currentOptions().maxInFlightBytes) {
+    if (m_CancelToken.isCanceled()) {
+      return false;
+    }
+    m_Scheduler.m_StateChanged.wait_for(lock, CANCEL_POLL_INTERVAL);
+  }
+
+  m_Bytes += bytes;
+  m_Scheduler.m_InFlightBytes += bytes;
+  return true;
+}
+
+void ExtractionScheduler::Job::releaseBytes(uint64_t bytes)
+{
+  {
+    std::scoped_lock lock(m_Scheduler.m_Mutex);
+    bytes = std::min(bytes, m_Bytes);
+    m_Bytes -= bytes;
+    m_Scheduler.m_InFlightBytes -= bytes;
+  }
+  m_Scheduler.m_StateChanged.notify_all();
+}
+
+ExtractionScheduler& ExtractionScheduler::instance()
+{
+  // The scheduler is never destroyed: its threads cannot be joined safely while the
+  // library is being unloaded.
+  static ExtractionScheduler* scheduler =
+      new ExtractionScheduler(std::max<std::size_t>(currentOptions().writerThreads, 1));
+  return *scheduler;
+}
+
+void ExtractionScheduler::configure(Archive::SchedulerOptions const& newOptions)
+{
+  std::scoped_lock lock(optionsMutex());
+  options() = newOptions;
+}
+
+std::mutex& ExtractionScheduler::optionsMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+Archive::SchedulerOptions& ExtractionScheduler::options()
+{
+  static Archive::SchedulerOptions options;
+  return options;
+}
+
+Archive::SchedulerOptions ExtractionScheduler::currentOptions()
+{
+  std::scoped_lock lock(optionsMutex());
+  return options();
+}
+
+std::wstring ExtractionScheduler::deviceOf(std::filesystem::path const& path)
+{
+  // This works even if the path does not exist (yet):
+  wchar_t volume[MAX_PATH + 1];
+  if (::GetVolumePathNameW(path.c_str(), volume, MAX_PATH + 1)) {
+    return ArchiveStrings::towlower(volume);
+  }
+  return ArchiveStrings::towlower(path.root_name().native());
+}
+
+ExtractionScheduler::ExtractionScheduler(std::size_t nThreads)
+    : m_InFlightBytes(0), m_NextTicket(0)
+{
+  for (std::size_t i = 0; i < nThreads; ++i) {
+    m_Threads.emplace_back(&ExtractionScheduler::run, this);
+  }
+}
+
+std::shared_ptr<ExtractionScheduler::Job>
+ExtractionScheduler::join(std::filesystem::path const& outputDirectory,
+                          CancellationToken const& cancelToken)
+{
+  const auto key = deviceOf(outputDirectory);
+
+  std::unique_lock lock(m_Mutex);
+  auto& device          = m_Devices[key];
+  const uint64_t ticket = m_NextTicket++;
+  device.waiting.push_back(ticket);
+
+  // Extractions are admitted in order of arrival:
+  while (device.waiting.front() != ticket ||
+         device.active >= std::max<std::size_t>(
+                              currentOptions().maxExtractionsPerDevice, 1)) {
+    if (cancelToken.isCanceled()) {
+      device.waiting.erase(
+          std::find(device.waiting.begin(), device.waiting.end(), ticket));
+      lock.unlock();
+      m_StateChanged.notify_all();
+      return nullptr;
+    }
+    m_StateChanged.wait_for(lock, CANCEL_POLL_INTERVAL);
+  }
+
+  device.waiting.pop_front();
+  device.active++;
+  lock.unlock();
+
+  // Let the next extraction in line check if it can start as well:
+  m_StateChanged.notify_all();
+
+  return std::shared_ptr<Job>(new Job(*this, key, cancelToken));
+}
+
+void ExtractionScheduler::leave(Job& job)
+{
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_InFlightBytes -= job.m_Bytes;
+
+    auto it = m_Devices.find(job.m_Device);
+    it->second.active--;
+    if (it->second.active == 0 && it->second.waiting.empty()) {
+      m_Devices.erase(it);
+    }
+  }
+  m_StateChanged.notify_all();
+}
+
+void ExtractionScheduler::run()
+{
+  std::unique_lock lock(m_Mutex);
+  while (true) {
+    m_TaskAvailable.wait(lock, [this] {
+      return !m_ReadyJobs.empty();
+    });
+
+    // Take one task from the first job, and put it back at the end of the line if
+    // it has more:
+    Job* job = m_ReadyJobs.front();
+    m_ReadyJobs.pop_front();
+
+    Task task = std::move(job->m_Tasks.front());
+    job->m_Tasks.pop_front();
+    if (!job->m_Tasks.empty()) {
+      m_ReadyJobs.push_back(job);
+    }
+
+    // The job must not be used once the task is done, since its owner may be
+    // waiting for this task to destroy it. The task is also destroyed before
+    // locking again, since destroying what it captured may need the lock:
+    lock.unlock();
+    task();
+    task = nullptr;
+    lock.lock();
+  }
+}
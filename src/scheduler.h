@@ -0,0 +1,171 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_SCHEDULER_H
+#define ARCHIVE_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "archive.h"
+#include "cancellation.h"
+
+/**
+ * Process-wide scheduler shared by the extractions that opt into it (see
+ * Archive::ExtractOptions::useSharedScheduler).
+ *
+ * The scheduler provides:
+ *  - a single pool of writer threads, on which tasks from the different extractions
+ *    are run in a round-robin fashion, so that a large extraction cannot starve the
+ *    others,
+ *  - a global budget of bytes held in memory waiting to be written,
+ *  - a limit on the number of extractions writing to the same volume at once, with
+ *    waiting extractions admitted in order of arrival.
+ *
+ * Each extraction registers itself with join(), and uses the returned Job until it
+ * is done.
+ */
+class ExtractionScheduler
+{
+public:
+  using Task = std::function<void()>;
+
+  class Job
+  {
+  public:
+    ~Job();
+
+    Job(Job const&)            = delete;
+    Job& operator=(Job const&) = delete;
+
+    /**
+     * @brief Run a task on the writer threads of the scheduler.
+     */
+    void post(Task task);
+
+    /**
+     * @brief Reserve bytes from the in-flight budget, waiting for other jobs to
+     * release some if needed.
+     *
+     * A job that holds no bytes is always granted its request, so that entries
+     * larger than the budget do not block forever.
+     *
+     * @return true if the bytes were reserved, false if the extraction was canceled
+     *     while waiting.
+     */
+    bool acquireBytes(uint64_t bytes);
+
+    /**
+     * @brief Give back bytes reserved with acquireBytes(). Thread-safe.
+     */
+    void releaseBytes(uint64_t bytes);
+
+  private:
+    friend class ExtractionScheduler;
+
+    Job(ExtractionScheduler& scheduler, std::wstring device,
+        CancellationToken const& cancelToken);
+
+    ExtractionScheduler& m_Scheduler;
+    std::wstring m_Device;
+    CancellationToken const& m_CancelToken;
+
+    // Guarded by the mutex of the scheduler:
+    std::deque<Task> m_Tasks;
+    uint64_t m_Bytes;
+  };
+
+  /**
+   * @return the scheduler of the process, created on first use with the current
+   *     options.
+   */
+  static ExtractionScheduler& instance();
+
+  /**
+   * @brief Change the options of the scheduler.
+   *
+   * The limits apply immediately, but the number of writer threads is only used
+   * when the scheduler is created, i.e., before the first extraction using it.
+   */
+  static void configure(Archive::SchedulerOptions const& options);
+
+  ExtractionScheduler(ExtractionScheduler const&)            = delete;
+  ExtractionScheduler& operator=(ExtractionScheduler const&) = delete;
+
+  /**
+   * @brief Register an extraction to the given directory, waiting until the volume
+   * containing it accepts one more extraction.
+   *
+   * @return the job for the extraction, or a null pointer if it was canceled while
+   *     waiting.
+   */
+  std::shared_ptr<Job> join(std::filesystem::path const& outputDirectory,
+                            CancellationToken const& cancelToken);
+
+private:
+  // Interval at which waiting extractions check if they were canceled.
+  static constexpr std::chrono::milliseconds CANCEL_POLL_INTERVAL{20};
+
+  struct Device
+  {
+    std::size_t active = 0;
+
+    // Tickets of the extractions waiting for this device, in order of arrival.
+    std::deque<uint64_t> waiting;
+  };
+
+  explicit ExtractionScheduler(std::size_t nThreads);
+
+  // Options shared by all the instances, guarded by optionsMutex().
+  static std::mutex& optionsMutex();
+  static Archive::SchedulerOptions& options();
+  static Archive::SchedulerOptions currentOptions();
+
+  // Key identifying the volume containing the given path.
+  static std::wstring deviceOf(std::filesystem::path const& path);
+
+  void leave(Job& job);
+  void run();
+
+  std::mutex m_Mutex;
+  std::condition_variable m_TaskAvailable;
+  std::condition_variable m_StateChanged;
+
+  // Jobs that have pending tasks, served in a round-robin fashion.
+  std::deque<Job*> m_ReadyJobs;
+
+  uint64_t m_InFlightBytes;
+  uint64_t m_NextTicket;
+  std::map<std::wstring, Device> m_Devices;
+
+  std::vector<std::thread> m_Threads;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "testcallback.h"
+
+#include "extractcallback.h"
+
+CArchiveTestCallback::CArchiveTestCallback(ErrorCallback errorCallback,
+                                           Archive::PasswordCallback passwordCallback,
+                                           CancellationToken const* cancelToken)
+    : m_ErrorCallback(errorCallback), m_PasswordCallback(passwordCallback),
+      m_CancelToken(cancelToken), m_CurrentIndex(0)
+{}
+
+STDMETHODIMP CArchiveTestCallback::SetTotal(UInt64) throw()
+{
+  return S_OK;
+}
+
+STDMETHODIMP CArchiveTestCallback::SetCompleted(const UInt64*) throw()
+{
+  return m_CancelToken->isCanceled() ? E_ABORT : S_OK;
+}
+
+STDMETHODIMP CArchiveTestCallback::GetStream(UInt32 index,
+                                             ISequentialOutStream** outStream,
+                                             Int32) throw()
+{
+  // In test mode, the handler does not write the data anywhere:
+  *outStream     = nullptr;
+  m_CurrentIndex = index;
+  return S_OK;
+}
+
+STDMETHODIMP CArchiveTestCallback::PrepareOperation(Int32) throw()
+{
+  return m_CancelToken->isCanceled() ? E_ABORT : S_OK;
+}
+
+STDMETHODIMP CArchiveTestCallback::SetOperationResult(Int32 operationResult) throw()
+{
+  if (operationResult != NArchive::NExtract::NOperationResult::kOK && m_ErrorCallback) {
+    m_ErrorCallback(m_CurrentIndex, operationResultToString(operationResult));
+  }
+  return S_OK;
+}
+
+STDMETHODIMP CArchiveTestCallback::CryptoGetTextPassword(BSTR* passwordOut)
+{
+  std::wstring password = m_PasswordCallback ? m_PasswordCallback() : std::wstring{};
+  *passwordOut          = ::SysAllocString(password.c_str());
+  return *passwordOut != 0 ? S_OK : E_OUTOFMEMORY;
+}
@@ -0,0 +1,70 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_TESTCALLBACK_H
+#define ARCHIVE_TESTCALLBACK_H
+
+#include <functional>
+#include <string>
+
+#include "7zip/Archive/IArchive.h"
+#include "7zip/IPassword.h"
+
+#include "archive.h"
+#include "cancellation.h"
+#include "unknown_impl.h"
+
+/**
+ * Extract callback used to test entries (i.e., decode them and check their CRC
+ * without writing them anywhere), see Archive::test().
+ */
+class CArchiveTestCallback : public IArchiveExtractCallback,
+                             public ICryptoGetTextPassword
+{
+
+  UNKNOWN_3_INTERFACE(IArchiveExtractCallback, ICryptoGetTextPassword, IProgress);
+
+public:
+  // Called with the index of the entry that failed and the reason.
+  using ErrorCallback = std::function<void(UInt32, std::wstring const&)>;
+
+  // The password callback must return the password to use, it is only called if
+  // the archive requires a password.
+  CArchiveTestCallback(ErrorCallback errorCallback,
+                       Archive::PasswordCallback passwordCallback,
+                       CancellationToken const* cancelToken);
+
+  virtual ~CArchiveTestCallback() {}
+
+  Z7_IFACE_COM7_IMP(IProgress)
+  Z7_IFACE_COM7_IMP(IArchiveExtractCallback)
+
+  // ICryptoGetTextPassword
+  STDMETHOD(CryptoGetTextPassword)(BSTR* password);
+
+private:
+  ErrorCallback m_ErrorCallback;
+  Archive::PasswordCallback m_PasswordCallback;
+  CancellationToken const* m_CancelToken;
+
+  UInt32 m_CurrentIndex;
+};
+
+#endif
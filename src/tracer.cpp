@@ -0,0 +1,292 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "tracer.h"
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+namespace ArchiveTrace
+{
+
+std::atomic<bool> detail::enabled{false};
+
+namespace
+{
+
+  // Number of spans kept in the ring buffer, which takes about 7 MiB once allocated.
+  constexpr std::uint64_t CAPACITY = 1 << 17;
+
+  // Maximum number of strings interned for a trace, there is no point in keeping
+  // more than the ring buffer can hold.
+  constexpr std::size_t MAX_STRINGS = CAPACITY;
+
+  // Slot of the ring buffer. The sequence tells whether the slot holds a complete
+  // span, and which one: it is 2 * ticket + 1 while the span with the given ticket
+  // is being written, and 2 * ticket + 2 once it is complete. Readers check that it
+  // did not change while they were reading the span.
+  struct Slot
+  {
+    std::atomic<std::uint64_t> sequence{0};
+    std::atomic<const char*> category{nullptr};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<const char*> detail{nullptr};
+    std::atomic<std::int64_t> entry{NO_ENTRY};
+    std::atomic<std::int64_t> start{0};
+    std::atomic<std::int64_t> duration{0};
+    std::atomic<std::uint32_t> thread{0};
+  };
+
+  std::int64_t nanoseconds(clock_t::duration duration)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  }
+
+  class Recorder
+  {
+  public:
+    static Recorder& instance()
+    {
+      static Recorder recorder;
+      return recorder;
+    }
+
+    void start()
+    {
+      std::scoped_lock lock(m_Mutex);
+      if (!m_Slots) {
+        m_Slots = std::make_unique<Slot[]>(CAPACITY);
+        m_SlotsPtr.store(m_Slots.get(), std::memory_order_release);
+      }
+
+      // The strings of the previous trace can go, since they are only used by spans
+      // that started before the new epoch, which are never exported. This must be
+      // done before the epoch is taken, see Span:
+      {
+        std::scoped_lock stringsLock(m_StringsMutex);
+        m_Strings.clear();
+      }
+
+      // Spans of the previous trace are not cleared, they are simply filtered out
+      // when exporting, so recording never has to synchronize with this:
+      m_FirstTicket = m_Next.load(std::memory_order_relaxed);
+      m_Epoch       = clock_t::now();
+      detail::enabled.store(true, std::memory_order_relaxed);
+    }
+
+    void record(const char* category, const char* name, clock_t::time_point start,
+                std::int64_t entry, const char* detail)
+    {
+      Slot* slots = m_SlotsPtr.load(std::memory_order_acquire);
+      if (slots == nullptr) {
+        return;
+      }
+
+      thread_local const std::uint32_t threadId = ::GetCurrentThreadId();
+      const auto end    = clock_t::now();
+      const auto ticket = m_Next.fetch_add(1, std::memory_order_relaxed);
+
+      Slot& slot = slots[ticket % CAPACITY];
+      slot.sequence.store(2 * ticket + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      slot.category.store(category, std::memory_order_relaxed);
+      slot.name.store(name, std::memory_order_relaxed);
+      slot.detail.store(detail, std::memory_order_relaxed);
+      slot.entry.store(entry, std::memory_order_relaxed);
+      slot.start.store(nanoseconds(start.time_since_epoch()),
+                       std::memory_order_relaxed);
+      slot.duration.store(nanoseconds(end - start), std::memory_order_relaxed);
+      slot.thread.store(threadId, std::memory_order_relaxed);
+
+      slot.sequence.store(2 * ticket + 2, std::memory_order_release);
+    }
+
+    std::string exportJson()
+    {
+      std::scoped_lock lock(m_Mutex);
+
+      std::string json = "{\"traceEvents\":[";
+      std::uint64_t dropped = 0;
+
+      if (m_Slots) {
+        const auto next  = m_Next.load(std::memory_order_acquire);
+        const auto oldest = next > CAPACITY ? next - CAPACITY : 0;
+        const auto first  = std::max(m_FirstTicket, oldest);
+        const auto epoch  = nanoseconds(m_Epoch.time_since_epoch());
+        const auto pid    = ::GetCurrentProcessId();
+
+        // Spans that were overwritten, or are being written right now:
+        dropped = first - m_FirstTicket;
+
+        bool firstEvent = true;
+        for (auto ticket = first; ticket < next; ++ticket) {
+          Slot& slot          = m_Slots[ticket % CAPACITY];
+          const auto sequence = slot.sequence.load(std::memory_order_acquire);
+          if (sequence != 2 * ticket + 2) {
+            dropped++;
+            continue;
+          }
+
+          const char* category = slot.category.load(std::memory_order_relaxed);
+          const char* name     = slot.name.load(std::memory_order_relaxed);
+          const char* detail   = slot.detail.load(std::memory_order_relaxed);
+          const auto entry     = slot.entry.load(std::memory_order_relaxed);
+          const auto start     = slot.start.load(std::memory_order_relaxed);
+          const auto duration  = slot.duration.load(std::memory_order_relaxed);
+          const auto thread    = slot.thread.load(std::memory_order_relaxed);
+
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            dropped++;
+            continue;
+          }
+
+          // Spans started before the trace belong to the previous one:
+          if (start < epoch) {
+            continue;
+          }
+
+          json += firstEvent ? "\n" : ",\n";
+          firstEvent = false;
+
+          auto out = std::back_inserter(json);
+          std::format_to(out,
+                         "{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},"
+                         "\"dur\":{:.3f},\"pid\":{},\"tid\":{}",
+                         name, category, (start - epoch) / 1000.0, duration / 1000.0,
+                         pid, thread);
+
+          if (entry != NO_ENTRY || detail != nullptr) {
+            json += ",\"args\":{";
+            if (entry != NO_ENTRY) {
+              std::format_to(out, "\"entry\":{}", entry);
+            }
+            if (detail != nullptr) {
+              std::format_to(out, "{}\"detail\":\"{}\"",
+                             entry != NO_ENTRY ? "," : "", detail);
+            }
+            json += "}";
+          }
+          json += "}";
+        }
+      }
+
+      std::format_to(std::back_inserter(json),
+                     "\n],\"displayTimeUnit\":\"ms\","
+                     "\"otherData\":{{\"droppedSpans\":{}}}}}\n",
+                     dropped);
+      return json;
+    }
+
+    const char* intern(std::wstring_view string)
+    {
+      std::string utf8;
+      if (!string.empty()) {
+        const int size = ::WideCharToMultiByte(CP_UTF8, 0, string.data(),
+                                               static_cast<int>(string.size()),
+                                               nullptr, 0, nullptr, nullptr);
+        utf8.resize(size);
+        ::WideCharToMultiByte(CP_UTF8, 0, string.data(),
+                              static_cast<int>(string.size()), utf8.data(), size,
+                              nullptr, nullptr);
+      }
+
+      std::string escaped;
+      for (char c : utf8) {
+        if (c == '"' || c == '\\') {
+          escaped += '\\';
+          escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          std::format_to(std::back_inserter(escaped), "\\u{:04x}",
+                         static_cast<int>(c));
+        } else {
+          escaped += c;
+        }
+      }
+
+      // Strings are only removed by start(), since spans of the current trace may
+      // still use them:
+      std::scoped_lock lock(m_StringsMutex);
+      auto it = m_Strings.find(escaped);
+      if (it == m_Strings.end()) {
+        if (m_Strings.size() >= MAX_STRINGS) {
+          return nullptr;
+        }
+        it = m_Strings.insert(std::move(escaped)).first;
+      }
+      return it->c_str();
+    }
+
+  private:
+    Recorder() = default;
+
+    std::mutex m_Mutex;
+    std::unique_ptr<Slot[]> m_Slots;
+    std::atomic<Slot*> m_SlotsPtr{nullptr};
+
+    // Ticket of the next span, and of the first span of the current trace:
+    std::atomic<std::uint64_t> m_Next{0};
+    std::uint64_t m_FirstTicket{0};
+    clock_t::time_point m_Epoch;
+
+    // Node-based, so the strings do not move when new ones are inserted:
+    std::mutex m_StringsMutex;
+    std::unordered_set<std::string> m_Strings;
+  };
+
+}  // namespace
+
+void start()
+{
+  Recorder::instance().start();
+}
+
+void stop()
+{
+  detail::enabled.store(false, std::memory_order_relaxed);
+}
+
+std::string exportJson()
+{
+  return Recorder::instance().exportJson();
+}
+
+const char* intern(std::wstring_view string)
+{
+  return Recorder::instance().intern(string);
+}
+
+void record(const char* category, const char* name, clock_t::time_point start,
+            std::int64_t entry, const char* detail)
+{
+  if (!isEnabled() || start == clock_t::time_point{}) {
+    return;
+  }
+  Recorder::instance().record(category, name, start, entry, detail);
+}
+
+}  // namespace ArchiveTrace
@@ -0,0 +1,135 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_TRACER_H
+#define ARCHIVE_TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ArchiveTrace
+{
+
+namespace detail
+{
+  extern std::atomic<bool> enabled;
+}
+
+using clock_t = std::chrono::steady_clock;
+
+// Entry of the spans that do not relate to a specific entry of the archive.
+inline constexpr std::int64_t NO_ENTRY = -1;
+
+/**
+ * @return true if a trace is being recorded. When not, spans only cost a relaxed
+ *     load.
+ */
+inline bool isEnabled()
+{
+  return detail::enabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Start recording a new trace, discarding the previous one.
+ *
+ * Spans are kept in a fixed-size ring buffer shared by all the threads, so only the
+ * most recent ones are exported if there are too many.
+ */
+void start();
+
+/**
+ * @brief Stop recording. The trace can still be exported afterwards.
+ */
+void stop();
+
+/**
+ * @return the spans recorded since the last start() as Chrome trace-event JSON,
+ *     which can be loaded in chrome://tracing or in Perfetto.
+ */
+std::string exportJson();
+
+/**
+ * @return a copy of the given string, in UTF-8 and escaped for JSON, that can be
+ *     used as the detail of spans started after the last start(), or nullptr if too
+ *     many strings were already interned for the current trace. The copy lives until
+ *     the next start().
+ */
+const char* intern(std::wstring_view string);
+
+/**
+ * @brief Record a span that ended now. Does nothing if no trace is being recorded
+ * or if start is not set.
+ *
+ * @param category Category of the span, must be a string literal.
+ * @param name Name of the span, must be a string literal.
+ * @param start Time at which the span started.
+ * @param entry Index of the entry of the archive, or NO_ENTRY.
+ * @param detail Additional detail of the span, from intern(), or nullptr.
+ */
+void record(const char* category, const char* name, clock_t::time_point start,
+            std::int64_t entry = NO_ENTRY, const char* detail = nullptr);
+
+/**
+ * Guard recording a span from its construction to its destruction on the current
+ * thread.
+ */
+class Span
+{
+public:
+  Span(const char* category, const char* name, std::int64_t entry = NO_ENTRY,
+       std::wstring_view detail = {})
+      : m_Category{category}, m_Name{name}, m_Entry{entry}, m_Detail{nullptr}
+  {
+    if (isEnabled()) {
+      // The start is taken first, so that the detail always belongs to the trace
+      // the span is exported with:
+      m_Start = clock_t::now();
+      if (!detail.empty()) {
+        m_Detail = intern(detail);
+      }
+    }
+  }
+
+  Span(Span const&)            = delete;
+  Span(Span&&)                 = delete;
+  Span& operator=(Span const&) = delete;
+  Span& operator=(Span&&)      = delete;
+
+  ~Span()
+  {
+    if (m_Start != clock_t::time_point{}) {
+      record(m_Category, m_Name, m_Start, m_Entry, m_Detail);
+    }
+  }
+
+private:
+  const char* m_Category;
+  const char* m_Name;
+  std::int64_t m_Entry;
+  const char* m_Detail;
+  clock_t::time_point m_Start;
+};
+
+}  // namespace ArchiveTrace
+
+#endif
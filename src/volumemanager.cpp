@@ -0,0 +1,84 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "volumemanager.h"
+
+#include "formatter.h"
+
+VolumeManager::VolumeManager(std::filesystem::path const& archivePath)
+    : m_Directory(archivePath.parent_path()), m_Scanned(false)
+{
+  // All the volumes of an archive share at least the part of the name before the
+  // first dot, which avoids listing the whole directory:
+  auto filename = archivePath.filename().native();
+  m_Prefix      = filename.substr(0, filename.find(L'.'));
+}
+
+void VolumeManager::scan()
+{
+  m_Scanned = true;
+
+  // The information returned by the scan is all we need about the volumes, so we
+  // do not have to query every file:
+  WIN32_FIND_DATAW data;
+  HANDLE handle = ::FindFirstFileExW((m_Directory / (m_Prefix + L"*")).c_str(),
+                                     FindExInfoBasic, &data, FindExSearchNameMatch,
+                                     nullptr, FIND_FIRST_EX_LARGE_FETCH);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  do {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+      continue;
+    }
+
+    BY_HANDLE_FILE_INFORMATION fileInfo{};
+    fileInfo.dwFileAttributes = data.dwFileAttributes;
+    fileInfo.ftCreationTime   = data.ftCreationTime;
+    fileInfo.ftLastAccessTime = data.ftLastAccessTime;
+    fileInfo.ftLastWriteTime  = data.ftLastWriteTime;
+    fileInfo.nFileSizeHigh    = data.nFileSizeHigh;
+    fileInfo.nFileSizeLow     = data.nFileSizeLow;
+    fileInfo.nNumberOfLinks   = 1;
+
+    m_Volumes[ArchiveStrings::towlower(data.cFileName)] =
+        IO::FileInfo(m_Directory / data.cFileName, fileInfo);
+  } while (::FindNextFileW(handle, &data));
+
+  ::FindClose(handle);
+}
+
+bool VolumeManager::find(std::wstring const& name, IO::FileInfo& info)
+{
+  std::scoped_lock lock(m_Mutex);
+
+  if (!m_Scanned) {
+    scan();
+  }
+
+  auto it = m_Volumes.find(ArchiveStrings::towlower(name));
+  if (it == m_Volumes.end()) {
+    return false;
+  }
+
+  info = it->second;
+  return true;
+}
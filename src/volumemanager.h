@@ -0,0 +1,70 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_VOLUMEMANAGER_H
+#define ARCHIVE_VOLUMEMANAGER_H
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "fileio.h"
+
+/**
+ * Finds the volumes of a multi-volume archive, for the open callbacks of all the
+ * handlers that open the archive.
+ *
+ * The directory of the archive is scanned once, which gives the information of all
+ * the candidate volumes at once, so that no volume has to be queried separately.
+ * The volumes themselves are opened by the callbacks, only when the handlers ask for
+ * them, and are released with the handlers.
+ */
+class VolumeManager
+{
+public:
+  VolumeManager(std::filesystem::path const& archivePath);
+
+  VolumeManager(VolumeManager const&)            = delete;
+  VolumeManager& operator=(VolumeManager const&) = delete;
+
+  /**
+   * @brief Find a volume in the directory of the archive. Thread-safe.
+   *
+   * @param name Filename of the volume.
+   * @param info Receives the information of the volume.
+   *
+   * @return true if the volume was found, false otherwise.
+   */
+  bool find(std::wstring const& name, IO::FileInfo& info);
+
+private:
+  // List the candidate volumes in the directory.
+  void scan();
+
+  std::filesystem::path m_Directory;
+  std::wstring m_Prefix;
+
+  bool m_Scanned;
+  std::unordered_map<std::wstring, IO::FileInfo> m_Volumes;
+  std::mutex m_Mutex;
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "writerpool.h"
+
+#include <exception>
+#include <format>
+#include <utility>
+
+#include "formatter.h"
+
+WriterPool::WriterPool(std::size_t nThreads, std::size_t maxPendingJobs)
+    : m_MaxPendingJobs(maxPendingJobs), m_Posted(0), m_Running(0), m_Stop(false)
+{
+  for (std::size_t i = 0; i < nThreads; ++i) {
+    m_Threads.emplace_back(&WriterPool::run, this);
+  }
+}
+
+WriterPool::WriterPool(std::shared_ptr<ExtractionScheduler::Job> schedulerJob,
+                       std::size_t maxPendingJobs)
+    : m_MaxPendingJobs(maxPendingJobs), m_SchedulerJob(std::move(schedulerJob)),
+      m_Posted(0), m_Running(0), m_Stop(false)
+{}
+
+WriterPool::~WriterPool()
+{
+  wait();
+
+  {
+    std::scoped_lock lock(m_Mutex);
+    m_Stop = true;
+  }
+  m_JobAvailable.notify_all();
+
+  for (auto& thread : m_Threads) {
+    thread.join();
+  }
+}
+
+void WriterPool::submit(Job job)
+{
+  if (m_SchedulerJob) {
+    std::unique_lock lock(m_Mutex);
+    m_JobDone.wait(lock, [this] {
+      return m_Posted < m_MaxPendingJobs;
+    });
+    m_Posted++;
+    lock.unlock();
+
+    m_SchedulerJob->post([this, job = std::move(job)] {
+      execute(job);
+
+      std::scoped_lock lock(m_Mutex);
+      m_Posted--;
+      m_JobDone.notify_all();
+    });
+    return;
+  }
+
+  std::unique_lock lock(m_Mutex);
+  m_JobDone.wait(lock, [this] {
+    return m_Jobs.size() < m_MaxPendingJobs;
+  });
+  m_Jobs.push_back(std::move(job));
+  lock.unlock();
+
+  m_JobAvailable.notify_one();
+}
+
+void WriterPool::wait()
+{
+  std::unique_lock lock(m_Mutex);
+  m_JobDone.wait(lock, [this] {
+    return m_Jobs.empty() && m_Running == 0 && m_Posted == 0;
+  });
+}
+
+void WriterPool::reportError(std::wstring error)
+{
+  std::scoped_lock lock(m_ErrorsMutex);
+  m_Errors.push_back(std::move(error));
+}
+
+std::vector<std::wstring> WriterPool::takeErrors()
+{
+  std::scoped_lock lock(m_ErrorsMutex);
+  return std::exchange(m_Errors, {});
+}
+
+void WriterPool::run()
+{
+  std::unique_lock lock(m_Mutex);
+  while (true) {
+    m_JobAvailable.wait(lock, [this] {
+      return m_Stop || !m_Jobs.empty();
+    });
+
+    if (m_Jobs.empty()) {
+      return;
+    }
+
+    Job job = std::move(m_Jobs.front());
+    m_Jobs.pop_front();
+    m_Running++;
+    lock.unlock();
+
+    execute(job);
+
+    lock.lock();
+    m_Running--;
+    m_JobDone.notify_all();
+  }
+}
+
+void WriterPool::execute(Job const& job)
+{
+  try {
+    job();
+  } catch (std::exception const& e) {
+    reportError(std::format(L"Caught exception {} in writer thread.", e));
+  }
+}
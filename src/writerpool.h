@@ -0,0 +1,110 @@
+/*
+Mod Organizer archive handling
+
+Copyright (C) 2020 MO2 Team. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ARCHIVE_WRITERPOOL_H
+#define ARCHIVE_WRITERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "scheduler.h"
+
+/**
+ * Small pool of threads used to run file operations (writing buffered files,
+ * closing files, ...) outside of the decoding thread.
+ *
+ * The number of pending jobs is bounded: submit() blocks when too many jobs are
+ * waiting, which also bounds the memory and the number of handles held by the
+ * pending jobs.
+ *
+ * Jobs cannot return errors directly, they report them through reportError(), and
+ * the owner of the pool retrieves them with takeErrors() once wait() has returned.
+ *
+ * The pool can either have its own threads, or run its jobs on the threads of the
+ * process-wide scheduler.
+ */
+class WriterPool
+{
+public:
+  using Job = std::function<void()>;
+
+  WriterPool(std::size_t nThreads, std::size_t maxPendingJobs);
+
+  // Run the jobs of this pool on the threads of the scheduler.
+  WriterPool(std::shared_ptr<ExtractionScheduler::Job> schedulerJob,
+             std::size_t maxPendingJobs);
+
+  // Wait for all the pending jobs and stop the threads.
+  ~WriterPool();
+
+  WriterPool(WriterPool const&)            = delete;
+  WriterPool& operator=(WriterPool const&) = delete;
+
+  /**
+   * @brief Submit a job to the pool, blocking while the pool is full.
+   */
+  void submit(Job job);
+
+  /**
+   * @brief Wait until all the submitted jobs are done.
+   */
+  void wait();
+
+  /**
+   * @brief Report an error from a job. Thread-safe.
+   */
+  void reportError(std::wstring error);
+
+  /**
+   * @return the errors reported since the last call, and clear them.
+   */
+  std::vector<std::wstring> takeErrors();
+
+private:
+  void run();
+  void execute(Job const& job);
+
+  std::size_t m_MaxPendingJobs;
+  std::shared_ptr<ExtractionScheduler::Job> m_SchedulerJob;
+
+  // Jobs submitted to the scheduler that are not done yet.
+  std::size_t m_Posted;
+
+  std::deque<Job> m_Jobs;
+  std::size_t m_Running;
+  bool m_Stop;
+
+  std::mutex m_Mutex;
+  std::condition_variable m_JobAvailable;
+  std::condition_variable m_JobDone;
+
+  std::mutex m_ErrorsMutex;
+  std::vector<std::wstring> m_Errors;
+
+  std::vector<std::thread> m_Threads;
+};
+
+#endif